@@ -41,6 +41,7 @@ void Board::nullMove() {
         int file = index & 7;
         currentZobristKey ^= Zobrist::enPassantKeys[file];
     }
+    zobristHistory[moveNumber] = currentZobristKey;
 }
 
 void Board::undoNullMove() {
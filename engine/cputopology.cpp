@@ -0,0 +1,205 @@
+#include "cputopology.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <thread>
+#include <utility>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#define MPOL_INTERLEAVE 3
+#endif
+
+static int readSysfsInt(const std::string &path, int fallback) {
+    std::ifstream file(path);
+    int value;
+    if (file >> value)
+        return value;
+    return fallback;
+}
+
+std::vector<int> CpuTopology::parseCpuList(const std::string &list) {
+    // Kernel cpu lists look like "0-3,8-11"
+    std::vector<int> result;
+    std::stringstream stream(list);
+    std::string range;
+    while (std::getline(stream, range, ',')) {
+        if (range.empty() || range == "\n")
+            continue;
+        size_t dash = range.find('-');
+        try {
+            int first = std::stoi(range.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for (int cpu = first; cpu <= last; cpu++)
+                result.push_back(cpu);
+        } catch (const std::exception &) {
+        }
+    }
+    return result;
+}
+
+void CpuTopology::init() {
+    cpus.clear();
+    nodes.clear();
+    placementOrder.clear();
+
+#ifdef __linux__
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        for (int cpu = 0; cpu < static_cast<int>(std::thread::hardware_concurrency()); cpu++)
+            CPU_SET(cpu, &allowed);
+    }
+
+    std::map<int, int> nodeOfCpu;
+    std::error_code error;
+    for (const auto &entry: std::filesystem::directory_iterator("/sys/devices/system/node", error)) {
+        std::string name = entry.path().filename().string();
+        if (!name.starts_with("node") || name.size() <= 4 || !std::isdigit(name[4]))
+            continue;
+
+        std::ifstream file(entry.path() / "cpulist");
+        std::string list;
+        std::getline(file, list);
+        for (int cpu: parseCpuList(list))
+            nodeOfCpu[cpu] = std::stoi(name.substr(4));
+    }
+
+    std::map<std::pair<int, int>, int> primaryOfCore;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed))
+            continue;
+
+        std::string topology = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/";
+        int core = readSysfsInt(topology + "core_id", cpu);
+        int package = readSysfsInt(topology + "physical_package_id", 0);
+        int node = nodeOfCpu.contains(cpu) ? nodeOfCpu[cpu] : 0;
+
+        bool primary = !primaryOfCore.contains({package, core});
+        if (primary)
+            primaryOfCore[{package, core}] = cpu;
+
+        cpus.push_back({cpu, core, package, node, primary});
+    }
+#endif
+
+    if (cpus.empty()) {
+        // No topology information, treat every hardware thread as its own core on a single node
+        int count = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+        for (int cpu = 0; cpu < count; cpu++)
+            cpus.push_back({cpu, cpu, 0, 0, true});
+    }
+
+    std::map<int, std::vector<int>> primariesByNode;
+    std::map<int, std::vector<int>> siblingsByNode;
+    for (const LogicalCpu &cpu: cpus) {
+        (cpu.primary ? primariesByNode : siblingsByNode)[cpu.node].push_back(cpu.id);
+    }
+
+    physicalCores = 0;
+    for (const auto &[node, list]: primariesByNode) {
+        physicalCores += static_cast<int>(list.size());
+        nodes.push_back(node);
+    }
+    nodeCount = static_cast<int>(primariesByNode.size());
+
+    // Round-robin across nodes so every node gets threads before any node gets a second one
+    for (auto *byNode: {&primariesByNode, &siblingsByNode}) {
+        for (size_t index = 0;; index++) {
+            bool added = false;
+            for (const auto &[node, list]: *byNode) {
+                if (index < list.size()) {
+                    placementOrder.push_back(list[index]);
+                    added = true;
+                }
+            }
+            if (!added)
+                break;
+        }
+    }
+}
+
+int CpuTopology::recommendedThreadCount() {
+    return std::max(1, useSiblings ? static_cast<int>(placementOrder.size()) : physicalCores);
+}
+
+int CpuTopology::cpuForThread(int threadNumber) {
+    int available = useSiblings ? static_cast<int>(placementOrder.size()) : physicalCores;
+    if (available <= 0 || threadNumber >= available)
+        return -1;
+    return placementOrder[threadNumber];
+}
+
+int CpuTopology::nodeForThread(int threadNumber) {
+    int cpu = cpuForThread(threadNumber);
+    for (const LogicalCpu &logicalCpu: cpus) {
+        if (logicalCpu.id == cpu)
+            return logicalCpu.node;
+    }
+    return 0;
+}
+
+void CpuTopology::pinCurrentThread(int threadNumber) {
+    if (!pinThreads)
+        return;
+
+    // Threads beyond the available cores are left for the OS to schedule
+    int cpu = cpuForThread(threadNumber);
+    if (cpu < 0)
+        return;
+
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+}
+
+void CpuTopology::pinCurrentThreadToNode(int node) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (const LogicalCpu &cpu: cpus) {
+        if (cpu.node == node)
+            CPU_SET(cpu.id, &set);
+    }
+    if (CPU_COUNT(&set) > 0)
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+}
+
+bool CpuTopology::interleaveMemory(void *address, size_t size) {
+#ifdef __linux__
+    if (nodeCount <= 1)
+        return false;
+
+    unsigned long nodeMask[16] = {};
+    for (const LogicalCpu &cpu: cpus) {
+        if (cpu.node < static_cast<int>(sizeof(nodeMask) * 8))
+            nodeMask[cpu.node / 64] |= 1UL << (cpu.node % 64);
+    }
+
+    // mbind works on whole pages, so shrink the range to the pages fully inside the buffer
+    auto pageSize = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    auto start = reinterpret_cast<uintptr_t>(address);
+    uintptr_t alignedStart = (start + pageSize - 1) & ~(pageSize - 1);
+    uintptr_t alignedEnd = (start + size) & ~(pageSize - 1);
+    if (alignedEnd <= alignedStart)
+        return false;
+
+    return syscall(SYS_mbind, alignedStart, alignedEnd - alignedStart, MPOL_INTERLEAVE, nodeMask,
+                   sizeof(nodeMask) * 8, 0) == 0;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/**
+ * A logical CPU the process is allowed to run on, as reported by sysfs. Only CPUs inside the affinity mask the
+ * engine was started with are recorded, so restricting the CPU set (taskset, cgroups) restricts the placement too.
+ */
+struct LogicalCpu {
+    int id;
+    int core;
+    int package;
+    int node;
+    bool primary; // first hardware thread of its physical core, the others are SMT siblings
+};
+
+namespace CpuTopology {
+    inline std::vector<LogicalCpu> cpus;
+
+    /**
+     * The order search threads are pinned in. Primary hardware threads come first, spread round-robin across NUMA
+     * nodes so that both memory controllers are used, then SMT siblings in the same order.
+     */
+    inline std::vector<int> placementOrder;
+
+    inline std::vector<int> nodes;
+
+    inline int physicalCores = 1;
+    inline int nodeCount = 1;
+
+    /**
+     * Set through Search::setParameter. pinThreads pins every search thread to its CPU of placementOrder,
+     * useSiblings also places threads on SMT siblings (and raises the recommended thread count to match), and
+     * interleaveTranspositionTable interleaves the pages of the next table allocated across NUMA nodes.
+     */
+    inline bool pinThreads = true;
+    inline bool useSiblings = false;
+    inline bool interleaveTranspositionTable = true;
+
+    void init();
+
+    int recommendedThreadCount();
+
+    int cpuForThread(int threadNumber);
+
+    int nodeForThread(int threadNumber);
+
+    void pinCurrentThread(int threadNumber);
+
+    void pinCurrentThreadToNode(int node);
+
+    bool interleaveMemory(void *address, size_t size);
+
+    std::vector<int> parseCpuList(const std::string &list);
+}
@@ -0,0 +1,344 @@
+#include "montecarlosearch.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <thread>
+
+#include "cputopology.h"
+#include "movegen.h"
+#include "search.h"
+#include "timemanager.h"
+
+static std::unique_ptr<MonteCarloNode[]> arena;
+static std::atomic<int> arenaUsed = 0;
+static std::atomic<bool> arenaFull = false;
+static uint64_t rootKey = 0;
+
+static std::atomic<long> playoutsCounted = 0;
+static std::atomic<long> collisionsCounted = 0;
+
+static void resetNode(MonteCarloNode &node, Move move, float prior) {
+    node.move = move;
+    node.prior = prior;
+    node.visits = 0;
+    node.virtualLoss = 0;
+    node.valueSum = 0;
+    node.firstChild = -1;
+    node.childCount = 0;
+    node.state = MonteCarloNode::UNEXPANDED;
+}
+
+static void copyNode(MonteCarloNode &to, const MonteCarloNode &from) {
+    to.move = from.move;
+    to.prior = from.prior;
+    to.visits = from.visits.load();
+    to.virtualLoss = 0;
+    to.valueSum = from.valueSum.load();
+    to.firstChild = -1;
+    to.childCount = 0;
+    to.state = from.state == MonteCarloNode::TERMINAL ? MonteCarloNode::TERMINAL : MonteCarloNode::UNEXPANDED;
+}
+
+/**
+ * Reserves count consecutive nodes, or returns -1 and flags the arena for recycling when they do not fit.
+ */
+static int allocate(int count) {
+    int first = arenaUsed.fetch_add(count);
+    if (first + count > MonteCarloSearch::ARENA_NODES) {
+        arenaUsed -= count;
+        arenaFull = true;
+        return -1;
+    }
+    return first;
+}
+
+double MonteCarloSearch::winProbability(int score) {
+    return 1.0 / (1.0 + std::pow(10.0, -static_cast<double>(score) / WIN_PROBABILITY_SCALE));
+}
+
+/**
+ * Expands a node whose state this thread switched to EXPANDING. Priors are a softmax over a rough material gain of
+ * each move, so captures of valuable pieces, promotions and checks get explored first.
+ */
+static void expand(Board &board, MonteCarloNode &node) {
+    ArrayVec<Move, 218> pseudoLegal = Movegen::generateAllLegalMovesOnBoard(board);
+    Move moves[218];
+    double gains[218];
+    int count = 0;
+    for (size_t i = 0; i < pseudoLegal.elements; i++) {
+        Move move = pseudoLegal.buffer[i];
+        if (!board.move(move))
+            continue;
+
+        double gain = 0;
+        if (move.capture != NONE)
+            gain += std::abs(Search::getPieceValue(move.capture)) - std::abs(Search::getPieceValue(move.pieceFrom)) / 10.0;
+        if (move.promotion != NONE)
+            gain += std::abs(Search::getPieceValue(move.promotion));
+        if (Movegen::isKingInDanger(board, board.whiteToMove))
+            gain += 100;
+        board.undoMove(move);
+
+        moves[count] = move;
+        gains[count++] = gain;
+    }
+
+    if (count == 0) {
+        node.state = MonteCarloNode::TERMINAL;
+        return;
+    }
+
+    int first = allocate(count);
+    if (first < 0) {
+        node.state = MonteCarloNode::UNEXPANDED;
+        return;
+    }
+
+    double maxGain = *std::max_element(gains, gains + count);
+    double total = 0;
+    for (int i = 0; i < count; i++) {
+        gains[i] = std::exp((gains[i] - maxGain) / MonteCarloSearch::PRIOR_TEMPERATURE);
+        total += gains[i];
+    }
+    for (int i = 0; i < count; i++)
+        resetNode(arena[first + i], moves[i], static_cast<float>(gains[i] / total));
+
+    node.firstChild = first;
+    node.childCount = count;
+    node.state.store(MonteCarloNode::EXPANDED, std::memory_order_release);
+}
+
+/**
+ * PUCT: the child maximizing Q + EXPLORATION * P * sqrt(N) / (1 + n). Unvisited children are assumed to be a bit
+ * worse than the parent (first play urgency), threads below a child count as losses until they back up.
+ */
+static int selectChild(const MonteCarloNode &node) {
+    int parentVisits = node.visits + node.virtualLoss;
+    double parentValue = parentVisits > 0 ? 1.0 - node.valueSum / parentVisits : 0.5;
+    double firstPlayUrgency = std::max(0.0, parentValue - MonteCarloSearch::FIRST_PLAY_URGENCY_REDUCTION);
+    double exploration = MonteCarloSearch::EXPLORATION * std::sqrt(static_cast<double>(std::max(1, parentVisits)));
+
+    int best = node.firstChild;
+    double bestScore = -1;
+    for (int i = node.firstChild; i < node.firstChild + node.childCount; i++) {
+        const MonteCarloNode &child = arena[i];
+        int visits = child.visits + child.virtualLoss;
+        double value = visits > 0 ? child.valueSum / visits : firstPlayUrgency;
+        double score = value + exploration * child.prior / (1 + visits);
+        if (score > bestScore) {
+            bestScore = score;
+            best = i;
+        }
+    }
+    return best;
+}
+
+static void playout(ThreadWorkerInfo *info) {
+    Board &board = info->board;
+    int path[MonteCarloSearch::MAX_TREE_DEPTH + 1];
+    int length = 0;
+
+    path[length++] = 0;
+    arena[0].virtualLoss++;
+    while (length <= MonteCarloSearch::MAX_TREE_DEPTH &&
+           arena[path[length - 1]].state.load(std::memory_order_acquire) == MonteCarloNode::EXPANDED) {
+        int child = selectChild(arena[path[length - 1]]);
+        board.move(arena[child].move);
+        arena[child].virtualLoss++;
+        path[length++] = child;
+    }
+
+    // Value of the leaf for its side to move
+    MonteCarloNode &leaf = arena[path[length - 1]];
+    double value = -1;
+    uint8_t state = leaf.state;
+    if (board.isDrawn()) {
+        value = 0.5;
+    } else if (state == MonteCarloNode::UNEXPANDED) {
+        if (leaf.state.compare_exchange_strong(state, MonteCarloNode::EXPANDING))
+            expand(board, leaf);
+        else
+            state = MonteCarloNode::EXPANDING;
+    }
+
+    if (leaf.state == MonteCarloNode::TERMINAL) {
+        value = Movegen::isKingInDanger(board, board.whiteToMove) ? 0.0 : 0.5;
+    } else if (state == MonteCarloNode::EXPANDING) {
+        // Another thread is expanding this leaf, back out instead of evaluating it twice
+        collisionsCounted++;
+    } else if (value < 0) {
+        value = MonteCarloSearch::winProbability(
+            Search::quiesce(board, info, 0, Search::NEGATIVE_INFINITY, Search::POSITIVE_INFINITY));
+    }
+
+    for (int i = length - 1; i >= 0; i--) {
+        MonteCarloNode &node = arena[path[i]];
+        if (value >= 0) {
+            // The node's value belongs to the side that moved into it, the opponent of the side to move there
+            value = 1.0 - value;
+            node.valueSum += value;
+            node.visits++;
+        }
+        node.virtualLoss--;
+        if (i > 0)
+            board.undoMove(node.move);
+    }
+    if (value >= 0)
+        playoutsCounted++;
+}
+
+static int keptNodes(int minVisits) {
+    int kept = 1;
+    std::vector<int> stack = {0};
+    while (!stack.empty()) {
+        const MonteCarloNode &node = arena[stack.back()];
+        stack.pop_back();
+        if (node.state != MonteCarloNode::EXPANDED || node.visits < minVisits)
+            continue;
+        kept += node.childCount;
+        for (int i = node.firstChild; i < node.firstChild + node.childCount; i++)
+            stack.push_back(i);
+    }
+    return kept;
+}
+
+/**
+ * Copies the part of the tree worth keeping to the front of a fresh arena, called while no thread is searching.
+ */
+static void recycleTree() {
+    int minVisits = MonteCarloSearch::RECYCLE_MIN_VISITS;
+    while (keptNodes(minVisits) > MonteCarloSearch::ARENA_NODES / 2)
+        minVisits *= 2;
+
+    auto recycled = std::make_unique<MonteCarloNode[]>(MonteCarloSearch::ARENA_NODES);
+    int used = 1;
+    copyNode(recycled[0], arena[0]);
+
+    std::vector<std::pair<int, int>> queue = {{0, 0}};
+    for (size_t q = 0; q < queue.size(); q++) {
+        auto [from, to] = queue[q];
+        const MonteCarloNode &node = arena[from];
+        if (node.state != MonteCarloNode::EXPANDED || node.visits < minVisits)
+            continue;
+
+        recycled[to].firstChild = used;
+        recycled[to].childCount = node.childCount;
+        recycled[to].state = MonteCarloNode::EXPANDED;
+        for (int i = 0; i < node.childCount; i++) {
+            copyNode(recycled[used + i], arena[node.firstChild + i]);
+            queue.emplace_back(node.firstChild + i, used + i);
+        }
+        used += node.childCount;
+    }
+
+    arena.swap(recycled);
+    arenaUsed = used;
+    arenaFull = false;
+}
+
+static void collectLines(MonteCarloResult &result) {
+    const MonteCarloNode &root = arena[0];
+    if (root.state != MonteCarloNode::EXPANDED)
+        return;
+
+    for (int i = root.firstChild; i < root.firstChild + root.childCount; i++) {
+        const MonteCarloNode &child = arena[i];
+        MonteCarloLine line;
+        line.move = child.move;
+        line.visits = child.visits;
+        line.winProbability = child.visits > 0 ? child.valueSum / child.visits : 0;
+
+        // Follow the most visited child
+        int current = i;
+        while (true) {
+            line.pv.push_back(arena[current].move);
+            const MonteCarloNode &node = arena[current];
+            if (node.state != MonteCarloNode::EXPANDED)
+                break;
+            int next = -1;
+            for (int c = node.firstChild; c < node.firstChild + node.childCount; c++) {
+                if (arena[c].visits > 0 && (next < 0 || arena[c].visits > arena[next].visits))
+                    next = c;
+            }
+            if (next < 0)
+                break;
+            current = next;
+        }
+        result.lines.push_back(line);
+    }
+
+    std::stable_sort(result.lines.begin(), result.lines.end(), [](const MonteCarloLine &a, const MonteCarloLine &b) {
+        return a.visits > b.visits;
+    });
+    result.bestMove = result.lines.front().move;
+    result.winProbability = result.lines.front().winProbability;
+}
+
+MonteCarloResult MonteCarloSearch::search(const Board &board, long milliseconds) {
+    if (!arena)
+        arena = std::make_unique<MonteCarloNode[]>(ARENA_NODES);
+    Search::transpositionTable.allocateIfNeeded();
+
+    if (board.currentZobristKey != rootKey || arenaUsed == 0) {
+        resetNode(arena[0], Search::NULL_MOVE, 1);
+        arenaUsed = 1;
+        rootKey = board.currentZobristKey;
+    }
+
+    // Expanded before the time check, so that a search without any time still lists the root moves
+    if (arena[0].state == MonteCarloNode::UNEXPANDED) {
+        Board root = board;
+        arena[0].state = MonteCarloNode::EXPANDING;
+        expand(root, arena[0]);
+    }
+
+    stopped = false;
+    playoutsCounted = 0;
+    collisionsCounted = 0;
+
+    // The leaves are valued by the regular quiescence search, which must not run into the time limit of a search
+    TimeControl timeControl;
+    timeControl.infinite = true;
+    TimeManager::start(timeControl);
+    Search::searchCancelled = false;
+
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + std::chrono::milliseconds(std::max(0L, milliseconds));
+    auto timeUp = [&] {
+        return stopped || (milliseconds >= 0 && std::chrono::steady_clock::now() >= deadline);
+    };
+
+    std::vector<std::unique_ptr<ThreadWorkerInfo>> threadWorkerInfos;
+    for (int threadNumber = 0; threadNumber < Search::MAX_THREADS; threadNumber++) {
+        threadWorkerInfos.emplace_back(std::make_unique<ThreadWorkerInfo>(threadNumber, 0));
+        memcpy(&threadWorkerInfos.back()->board, &board, sizeof(Board));
+    }
+
+    // Threads run until the arena is full, then the tree is recycled while they are stopped
+    while (!timeUp()) {
+        std::vector<std::thread> threads;
+        for (auto &info: threadWorkerInfos) {
+            threads.emplace_back([&timeUp, infoPtr = info.get()] {
+                CpuTopology::pinCurrentThread(infoPtr->threadNumber);
+                while (!arenaFull && !timeUp())
+                    playout(infoPtr);
+            });
+        }
+        for (auto &t: threads)
+            t.join();
+
+        if (arenaFull)
+            recycleTree();
+    }
+
+    MonteCarloResult result;
+    result.playouts = playoutsCounted;
+    result.collisions = collisionsCounted;
+    for (const auto &info: threadWorkerInfos)
+        result.nodes += info->nodes;
+    collectLines(result);
+    return result;
+}
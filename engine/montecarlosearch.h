@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "board.h"
+
+/**
+ * A node of the search tree, stored in an arena with the children of a node in one contiguous block. visits and
+ * valueSum are from the point of view of the side that played move, valueSum adding up win probabilities.
+ * virtualLoss counts the threads currently below the node, each of them counts as a lost visit during selection.
+ */
+struct MonteCarloNode {
+    enum State : uint8_t { UNEXPANDED, EXPANDING, EXPANDED, TERMINAL };
+
+    Move move;
+    float prior = 0;
+    std::atomic<int> visits = 0;
+    std::atomic<int> virtualLoss = 0;
+    std::atomic<double> valueSum = 0;
+    int firstChild = -1;
+    int childCount = 0;
+    std::atomic<uint8_t> state = UNEXPANDED;
+};
+
+struct MonteCarloLine {
+    Move move;
+    int visits = 0;
+    double winProbability = 0;
+    std::vector<Move> pv;
+};
+
+struct MonteCarloResult {
+    Move bestMove;
+    double winProbability = 0.5;
+    long playouts = 0;
+    long nodes = 0;
+    long collisions = 0;
+    std::vector<MonteCarloLine> lines;
+};
+
+/**
+ * Experimental PUCT tree search for broad analysis. Leaves are valued with a quiescence search converted to a win
+ * probability instead of random rollouts, priors come from cheap move features (captures, promotions, checks).
+ * Runs on MAX_THREADS threads that share the tree, spread out by virtual loss.
+ */
+namespace MonteCarloSearch {
+    inline constexpr double EXPLORATION = 1.5;
+    inline constexpr double FIRST_PLAY_URGENCY_REDUCTION = 0.2;
+    inline constexpr double PRIOR_TEMPERATURE = 200.0;
+
+    /**
+     * Centipawns to win probability: 1 / (1 + 10^(-score / WIN_PROBABILITY_SCALE)).
+     */
+    inline constexpr double WIN_PROBABILITY_SCALE = 400.0;
+
+    /**
+     * The arena holds ARENA_NODES nodes. When it fills up the search pauses and the tree is recycled: only children
+     * of nodes with at least a minimum number of visits are kept, that minimum doubling until the kept tree fits in
+     * half of the arena. Dropped subtrees keep the statistics of their root and are expanded again when selected.
+     */
+    inline constexpr int ARENA_NODES = 1 << 20;
+    inline constexpr int RECYCLE_MIN_VISITS = 2;
+
+    inline constexpr int MAX_TREE_DEPTH = 128;
+
+    inline std::atomic<bool> stopped = false;
+
+    /**
+     * Searches the position for the given time (negative until stopped). The tree is kept between calls on the same
+     * position, so analysis can be continued. Lines holds the root moves ordered by visits.
+     */
+    MonteCarloResult search(const Board &board, long milliseconds);
+
+    double winProbability(int score);
+}
@@ -186,6 +186,34 @@ bool Movegen::isSquareAttacked(Board &board, uint8_t kingIndex, bool white) {
     return false;
 }
 
+uint64_t Movegen::getBishopAttacks(uint8_t squareIndex, uint64_t occupancy) {
+    uint64_t blockers = BISHOP_MOVEMENT_MASKS[squareIndex] & occupancy;
+    return BISHOP_MOVE_TABLE[squareIndex][(blockers * BISHOP_MAGICS[squareIndex]) >> 52];
+}
+
+uint64_t Movegen::getRookAttacks(uint8_t squareIndex, uint64_t occupancy) {
+    uint64_t blockers = ROOK_MOVEMENT_MASKS[squareIndex] & occupancy;
+    return ROOK_MOVE_TABLE[squareIndex][(blockers * ROOK_MAGICS[squareIndex]) >> 52];
+}
+
+/**
+ * Every piece of either color attacking the square, with sliders looking through the given occupancy instead of the
+ * board's so that pieces can be removed one by one during an exchange.
+ */
+uint64_t Movegen::getAttackersToSquare(Board &board, uint8_t squareIndex, uint64_t occupancy) {
+    uint64_t diagonalSliders = board.BITBOARDS[WHITE_BISHOP] | board.BITBOARDS[BLACK_BISHOP] |
+                               board.BITBOARDS[WHITE_QUEEN] | board.BITBOARDS[BLACK_QUEEN];
+    uint64_t straightSliders = board.BITBOARDS[WHITE_ROOK] | board.BITBOARDS[BLACK_ROOK] |
+                               board.BITBOARDS[WHITE_QUEEN] | board.BITBOARDS[BLACK_QUEEN];
+
+    return (PAWN_ATTACK_MASKS[1][squareIndex] & board.BITBOARDS[WHITE_PAWN]) |
+           (PAWN_ATTACK_MASKS[0][squareIndex] & board.BITBOARDS[BLACK_PAWN]) |
+           (KNIGHT_MOVEMENT_MASKS[squareIndex] & (board.BITBOARDS[WHITE_KNIGHT] | board.BITBOARDS[BLACK_KNIGHT])) |
+           (KING_MOVEMENT_MASKS[squareIndex] & (board.BITBOARDS[WHITE_KING] | board.BITBOARDS[BLACK_KING])) |
+           (getBishopAttacks(squareIndex, occupancy) & diagonalSliders) |
+           (getRookAttacks(squareIndex, occupancy) & straightSliders);
+}
+
 
 uint64_t Movegen::generatePawnMovementMask(uint8_t squareIndex, bool white) {
     uint64_t moves = 0ULL;
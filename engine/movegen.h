@@ -136,6 +136,12 @@ namespace Movegen {
 
     bool isSquareAttacked(Board &board, uint8_t kingIndex, bool white);
 
+    uint64_t getBishopAttacks(uint8_t squareIndex, uint64_t occupancy);
+
+    uint64_t getRookAttacks(uint8_t squareIndex, uint64_t occupancy);
+
+    uint64_t getAttackersToSquare(Board &board, uint8_t squareIndex, uint64_t occupancy);
+
     bool isKingInDanger(Board &board, bool white);
 
     void init();
@@ -0,0 +1,343 @@
+#include "proofnumbersearch.h"
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+#include "movegen.h"
+#include "search.h"
+
+/**
+ *  PROOF TABLE ENTRY:
+ *  Zobrist Key ^ data: 64 bits
+ *  data:
+ *      phi: 26 bits
+ *      delta: 26 bits
+ *      remaining plies: 6 bits
+ *      mate distance in plies: 6 bits
+ */
+struct ProofEntry {
+    uint64_t zobristKey = 0;
+    uint64_t data = 0;
+};
+
+struct ProofNumbers {
+    uint32_t phi = 1;
+    uint32_t delta = 1;
+    int distance = 0;
+};
+
+struct ProofWorker {
+    Board board;
+    long nodes = 0;
+    bool cancellable = true;
+    bool timed = false;
+    bool pathDependentDraws = false;
+    std::chrono::steady_clock::time_point deadline;
+};
+
+static constexpr size_t TABLE_SIZE = 1ULL << ProofNumberSearch::TABLE_BITS;
+static constexpr size_t TABLE_MASK = TABLE_SIZE - 1;
+static constexpr long NODE_CHECK_INTERVAL = 1024;
+
+static std::vector<ProofEntry> table;
+
+/**
+ * The same position is a different problem with a different number of plies left, so both go into the index and
+ * the stored data.
+ */
+static uint64_t entryIndex(uint64_t zobristKey, int remaining) {
+    return (zobristKey ^ static_cast<uint64_t>(remaining) * 0x9E3779B97F4A7C15ULL) & TABLE_MASK;
+}
+
+static bool lookup(uint64_t zobristKey, int remaining, ProofNumbers &out) {
+    ProofEntry entry = table[entryIndex(zobristKey, remaining)];
+    if (entry.zobristKey == 0 || entry.zobristKey != (zobristKey ^ entry.data) ||
+        static_cast<int>((entry.data >> 52) & 0x3F) != remaining)
+        return false;
+
+    out.phi = static_cast<uint32_t>(entry.data & ProofNumberSearch::INFINITE_PROOF);
+    out.delta = static_cast<uint32_t>((entry.data >> 26) & ProofNumberSearch::INFINITE_PROOF);
+    out.distance = static_cast<int>((entry.data >> 58) & 0x3F);
+    return true;
+}
+
+static void store(uint64_t zobristKey, int remaining, const ProofNumbers &numbers) {
+    uint64_t data = static_cast<uint64_t>(numbers.phi) |
+                    static_cast<uint64_t>(numbers.delta) << 26 |
+                    static_cast<uint64_t>(remaining) << 52 |
+                    static_cast<uint64_t>(numbers.distance) << 58;
+    table[entryIndex(zobristKey, remaining)] = {zobristKey ^ data, data};
+}
+
+static uint32_t saturatingAdd(uint32_t a, uint32_t b) {
+    return static_cast<uint32_t>(std::min<uint64_t>(static_cast<uint64_t>(a) + b, ProofNumberSearch::INFINITE_PROOF));
+}
+
+static int generateChildren(Board &board, Move *moves, uint64_t *keys) {
+    ArrayVec<Move, 218> pseudoLegal = Movegen::generateAllLegalMovesOnBoard(board);
+    int count = 0;
+    for (size_t i = 0; i < pseudoLegal.elements; i++) {
+        Move move = pseudoLegal.buffer[i];
+        if (!board.move(move))
+            continue;
+        keys[count] = board.currentZobristKey;
+        moves[count++] = move;
+        board.undoMove(move);
+    }
+    return count;
+}
+
+/**
+ * Expands the node until its phi reaches thresholdPhi or its delta reaches thresholdDelta, then stores it. attacker
+ * is true at OR nodes, remaining is the number of plies the attacker still has to deliver mate in.
+ */
+static void multipleIterativeDeepening(ProofWorker &worker, int remaining, bool attacker, uint32_t thresholdPhi,
+                                       uint32_t thresholdDelta) {
+    using ProofNumberSearch::INFINITE_PROOF;
+
+    Board &board = worker.board;
+    uint64_t key = board.currentZobristKey;
+
+    if (++worker.nodes % NODE_CHECK_INTERVAL == 0) {
+        ProofNumberSearch::nodesCounted += NODE_CHECK_INTERVAL;
+        if (worker.timed && std::chrono::steady_clock::now() >= worker.deadline)
+            ProofNumberSearch::stopped = true;
+    }
+
+    // The defender wins everything that is not a mate within the limit. Draws by repetition depend on the path, so
+    // storing them can hide a mate reachable through a different move order, but never creates a false one. Any
+    // disproof found after one was stored is therefore not trusted
+    ProofNumbers defenderWins = attacker ? ProofNumbers{INFINITE_PROOF, 0, 0} : ProofNumbers{0, INFINITE_PROOF, 0};
+    if (attacker && remaining == 0) {
+        store(key, remaining, defenderWins);
+        return;
+    }
+    if (board.isDrawn()) {
+        worker.pathDependentDraws = true;
+        store(key, remaining, defenderWins);
+        return;
+    }
+
+    Move moves[218];
+    uint64_t keys[218];
+    int count = generateChildren(board, moves, keys);
+    if (count == 0) {
+        bool mated = Movegen::isKingInDanger(board, board.whiteToMove);
+        store(key, remaining, mated || attacker ? ProofNumbers{INFINITE_PROOF, 0, 0} : defenderWins);
+        return;
+    }
+    if (remaining == 0) {
+        store(key, remaining, defenderWins);
+        return;
+    }
+
+    ProofNumbers numbers;
+    while (true) {
+        numbers = {INFINITE_PROOF, 0, 0};
+        int best = 0;
+        uint32_t bestDelta = INFINITE_PROOF, secondDelta = INFINITE_PROOF, bestPhi = INFINITE_PROOF;
+        int fastestWin = MAX_PLY, slowestLoss = 0;
+
+        for (int i = 0; i < count; i++) {
+            ProofNumbers child;
+            lookup(keys[i], remaining - 1, child);
+
+            // phi is the cheapest child to refute, delta what it costs to prove every child
+            numbers.phi = std::min(numbers.phi, child.delta);
+            numbers.delta = saturatingAdd(numbers.delta, child.phi);
+            if (child.delta == 0)
+                fastestWin = std::min(fastestWin, child.distance);
+            slowestLoss = std::max(slowestLoss, child.distance);
+
+            if (child.delta < bestDelta) {
+                secondDelta = bestDelta;
+                bestDelta = child.delta;
+                bestPhi = child.phi;
+                best = i;
+            } else if (child.delta < secondDelta) {
+                secondDelta = child.delta;
+            }
+        }
+
+        if (numbers.phi == 0)
+            numbers.distance = fastestWin + 1;
+        else if (numbers.delta == 0)
+            numbers.distance = slowestLoss + 1;
+
+        if (numbers.phi >= thresholdPhi || numbers.delta >= thresholdDelta ||
+            (worker.cancellable && ProofNumberSearch::stopped))
+            break;
+
+        // Stay in the most proving child until it stops being the best one or the parent's delta would overflow
+        uint32_t childThresholdPhi = thresholdDelta >= INFINITE_PROOF
+                                         ? INFINITE_PROOF
+                                         : saturatingAdd(thresholdDelta - numbers.delta, bestPhi);
+        uint32_t childThresholdDelta = std::min(thresholdPhi, saturatingAdd(secondDelta, 1));
+
+        board.move(moves[best]);
+        multipleIterativeDeepening(worker, remaining - 1, !attacker, childThresholdPhi, childThresholdDelta);
+        board.undoMove(moves[best]);
+    }
+
+    store(key, remaining, numbers);
+}
+
+static bool solve(ProofWorker &worker, int remaining, bool attacker, ProofNumbers &out) {
+    using ProofNumberSearch::INFINITE_PROOF;
+    multipleIterativeDeepening(worker, remaining, attacker, INFINITE_PROOF, INFINITE_PROOF);
+    return lookup(worker.board.currentZobristKey, remaining, out) && (out.phi == 0 || out.delta == 0);
+}
+
+/**
+ * Walks the proof from the position after the first attacking move: the fastest mate at OR nodes, the longest
+ * defence at AND nodes. Children evicted from the table since they were proven are solved again, at OR nodes only
+ * until the first one is proven since refuting the others could cost as much as the whole search.
+ */
+static void extractLine(ProofWorker &worker, int remaining, std::vector<Move> &line) {
+    Board &board = worker.board;
+    bool attacker = false;
+
+    while (remaining > 0) {
+        Move moves[218];
+        uint64_t keys[218];
+        int count = generateChildren(board, moves, keys);
+
+        int chosen = -1, chosenDistance = 0;
+        auto consider = [&](int i, const ProofNumbers &child) {
+            bool proven = attacker ? child.delta == 0 : child.phi == 0;
+            bool better = chosen < 0 || (attacker ? child.distance < chosenDistance : child.distance > chosenDistance);
+            if (proven && better) {
+                chosen = i;
+                chosenDistance = child.distance;
+            }
+        };
+
+        bool unresolved[218] = {};
+        for (int i = 0; i < count; i++) {
+            ProofNumbers child;
+            unresolved[i] = !lookup(keys[i], remaining - 1, child) || (child.phi != 0 && child.delta != 0);
+            if (!unresolved[i])
+                consider(i, child);
+        }
+
+        for (int i = 0; i < count && !(attacker && chosen >= 0); i++) {
+            if (!unresolved[i])
+                continue;
+
+            ProofNumbers child;
+            board.move(moves[i]);
+            bool solved = solve(worker, remaining - 1, !attacker, child);
+            board.undoMove(moves[i]);
+            if (solved)
+                consider(i, child);
+        }
+
+        if (chosen < 0)
+            return;
+
+        line.push_back(moves[chosen]);
+        board.move(moves[chosen]);
+        remaining--;
+        attacker = !attacker;
+    }
+}
+
+MateSearchResult ProofNumberSearch::findMate(const Board &board, int mateIn, long maxMilliseconds) {
+    if (table.empty())
+        table.resize(TABLE_SIZE);
+    else
+        clearTable();
+
+    stopped = false;
+    nodesCounted = 0;
+
+    MateSearchResult result;
+    int maxPlies = 2 * std::clamp(mateIn, 1, MAX_MATE_IN) - 1;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max(0L, maxMilliseconds));
+
+    Board root = board;
+    Move rootMoves[218];
+    uint64_t rootKeys[218];
+    int rootCount = generateChildren(root, rootMoves, rootKeys);
+
+    // Root moves are handed out one at a time. Once a mate is found only children that could mate faster are still
+    // worth searching, with a correspondingly smaller limit
+    std::atomic<int> nextRootMove = 0;
+    std::atomic<bool> incomplete = false;
+    std::atomic<bool> pathDependentDraws = false;
+    std::mutex resultMutex;
+    int bestMove = -1, bestPlies = maxPlies + 2;
+
+    auto work = [&] {
+        ProofWorker worker;
+        worker.board = board;
+        worker.timed = maxMilliseconds >= 0;
+        worker.deadline = deadline;
+
+        int i;
+        while (!stopped && (i = nextRootMove++) < rootCount) {
+            int limit;
+            {
+                std::lock_guard lock(resultMutex);
+                limit = std::min(maxPlies, bestPlies - 2) - 1;
+            }
+            if (limit < 0)
+                continue;
+
+            worker.board.move(rootMoves[i]);
+            ProofNumbers child;
+            bool solved = solve(worker, limit, false, child);
+            worker.board.undoMove(rootMoves[i]);
+
+            if (!solved) {
+                incomplete = true;
+                continue;
+            }
+            if (child.delta == 0) {
+                std::lock_guard lock(resultMutex);
+                if (child.distance + 1 < bestPlies) {
+                    bestPlies = child.distance + 1;
+                    bestMove = i;
+                }
+            }
+        }
+        nodesCounted += worker.nodes % NODE_CHECK_INTERVAL;
+        if (worker.pathDependentDraws)
+            pathDependentDraws = true;
+    };
+
+    std::vector<std::thread> threads;
+    int threadCount = std::clamp(Search::MAX_THREADS, 1, std::max(1, rootCount));
+    for (int t = 1; t < threadCount; t++)
+        threads.emplace_back(work);
+    work();
+    for (auto &t : threads)
+        t.join();
+
+    result.nodes = nodesCounted;
+    if (bestMove >= 0) {
+        ProofWorker worker;
+        worker.board = board;
+        worker.cancellable = false;
+        result.line.push_back(rootMoves[bestMove]);
+        worker.board.move(rootMoves[bestMove]);
+        extractLine(worker, bestPlies - 1, result.line);
+
+        // Stored distances are those of the first proof found, the extracted line can be shorter
+        result.status = MateSearchResult::PROVEN;
+        result.mateIn = (static_cast<int>(result.line.size()) + 1) / 2;
+    } else if (!stopped && !incomplete && !pathDependentDraws) {
+        result.status = MateSearchResult::DISPROVEN;
+    } else {
+        result.pathDependentDraws = pathDependentDraws;
+    }
+
+    stopped = false;
+    return result;
+}
+
+void ProofNumberSearch::clearTable() {
+    std::fill(table.begin(), table.end(), ProofEntry{});
+}
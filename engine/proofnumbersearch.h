@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "board.h"
+
+/**
+ * Outcome of a "mate in N?" query. PROVEN comes with the mating line (attacker's moves and the longest defence),
+ * DISPROVEN means no mate exists within N moves, UNKNOWN that the time or node budget ran out first or that the
+ * refutation relied on a draw by repetition or the fifty move rule, which depend on the path to a position.
+ */
+struct MateSearchResult {
+    enum Status { PROVEN, DISPROVEN, UNKNOWN };
+
+    Status status = UNKNOWN;
+    bool pathDependentDraws = false;
+    int mateIn = 0;
+    std::vector<Move> line;
+    long nodes = 0;
+};
+
+/**
+ * Depth limited df-pn (depth-first proof-number search) for finding forced mates. The side to move is the attacker,
+ * its nodes are OR nodes (one move has to mate) and the defender's are AND nodes (every reply has to be mated).
+ * Every node is stored from the point of view of its side to move as phi (the proof number when it is winning, so
+ * the cost to prove the win) and delta (the cost to refute it).
+ */
+namespace ProofNumberSearch {
+    /**
+     * phi and delta saturate at INFINITE_PROOF, a value of 0 means the node is solved.
+     */
+    inline constexpr uint32_t INFINITE_PROOF = (1u << 26) - 1;
+
+    /**
+     * Bounded table of 2^TABLE_BITS entries (16 bytes each) shared by all threads. Entries are stored with the same
+     * key ^ data trick as the transposition table so torn writes are rejected without locks.
+     */
+    inline constexpr int TABLE_BITS = 22;
+
+    /**
+     * Mate distances are stored in 6 bits, longer queries are clamped.
+     */
+    inline constexpr int MAX_MATE_IN = 32;
+
+    inline std::atomic<bool> stopped = false;
+    inline std::atomic<long> nodesCounted = 0;
+
+    /**
+     * Searches for a mate in at most mateIn moves of the side to move, spreading the root moves over MAX_THREADS
+     * threads. Gives up after maxMilliseconds (negative for no limit) or when stopped is set.
+     */
+    MateSearchResult findMate(const Board &board, int mateIn, long maxMilliseconds);
+
+    /**
+     * Called by every query, entries are only valid for the query that stored them.
+     */
+    void clearTable();
+}
@@ -2,20 +2,25 @@
 
 #include <algorithm>
 #include <array>
+#include <bit>
+#include <cmath>
 #include <iostream>
 #include <thread>
+#include <unordered_map>
 #include <valarray>
 
+#include "cputopology.h"
 #include "movegen.h"
 #include "openingbook.h"
 #include "piecesquaretable.h"
 #include "san.h"
+#include "timemanager.h"
 #include "transpositiontable.h"
 #include "zobrist.h"
 
 #include <cstring>
 
-void Search::orderMoves(ArrayVec<Move, 218> &moveVector, int rootDepth, ThreadWorkerInfo *threadWorkerInfoPtr, Move ttMove, int depth) {
+void Search::orderMoves(ArrayVec<Move, 218> &moveVector, int rootDepth, ThreadWorkerInfo *threadWorkerInfoPtr, Move ttMove) {
     auto getMoveScore = [&](const Move &move) -> int {
         int score = 0;
 
@@ -23,10 +28,8 @@ void Search::orderMoves(ArrayVec<Move, 218> &moveVector, int rootDepth, ThreadWo
             score += TRANSPOSITION_TABLE_BIAS; // Give TT move a big boost
         }
 
-        if (threadWorkerInfoPtr != nullptr) {
-            if (move == threadWorkerInfoPtr->killerMoves[depth][0] || move == threadWorkerInfoPtr->killerMoves[depth][1]) {
-                score += KILLER_MOVE_BIAS;
-            }
+        if (threadWorkerInfoPtr != nullptr && isQuiet(move)) {
+            score += quietMoveScore(threadWorkerInfoPtr, move, rootDepth);
         }
 
         if (move.capture != NONE) {
@@ -34,89 +37,291 @@ void Search::orderMoves(ArrayVec<Move, 218> &moveVector, int rootDepth, ThreadWo
             score += (materialDelta >= 0 ? WINNING_CAPTURE_BIAS : LOSING_CAPTURE_BIAS) + materialDelta;
         }
 
-        if (move.promotion != -1) {
+        if (move.promotion != NONE) {
             score += PROMOTE_BIAS;
         }
 
         return score;
     };
 
-    std::sort(moveVector.buffer.begin(), moveVector.buffer.begin() + moveVector.elements,
-              [&](const Move &a, const Move &b) {
-                  return getMoveScore(a) > getMoveScore(b);
-              });
+    // Score every move once up front, the history lookups are too expensive to repeat inside the comparator
+    std::array<int, 218> scores{};
+    for (int i = 0; i < moveVector.elements; i++) {
+        scores[i] = getMoveScore(moveVector.buffer[i]);
+    }
 
-    if (rootDepth == 0) {
-        if (threadWorkerInfoPtr->threadNumber == 0 || moveVector.elements <= 1) {
-            // Main thread uses the standard ordering
-            return;
+    for (int i = 1; i < moveVector.elements; i++) {
+        Move move = moveVector.buffer[i];
+        int score = scores[i];
+        int j = i - 1;
+        while (j >= 0 && scores[j] < score) {
+            moveVector.buffer[j + 1] = moveVector.buffer[j];
+            scores[j + 1] = scores[j];
+            j--;
         }
+        moveVector.buffer[j + 1] = move;
+        scores[j + 1] = score;
+    }
+}
+
+void Search::diversifyRootMoves(ArrayVec<Move, 218> &moveVector, ThreadWorkerInfo *threadWorkerInfoPtr) {
+    if (threadWorkerInfoPtr->threadNumber == 0 || moveVector.elements <= 1) {
+        // Main thread uses the standard ordering
+        return;
+    }
+
+    // For helper threads, rotate the top N moves based on thread ID
+    int rotationCount = threadWorkerInfoPtr->threadNumber % std::min(4, static_cast<int>(moveVector.elements));
+    if (rotationCount > 0) {
+        // Only rotate among the top few moves (the most promising ones)
+        int topMovesToConsider = std::min(static_cast<int>(moveVector.elements), 4 + threadWorkerInfoPtr->threadNumber % 3);
+
+        // Shift the top moves by the rotation count
+        std::rotate(
+            moveVector.buffer.begin(),
+            moveVector.buffer.begin() + rotationCount % topMovesToConsider,
+            moveVector.buffer.begin() + topMovesToConsider
+        );
+    }
+}
+
+std::vector<RootMove> Search::generateRootMoves(Board &board, const std::vector<Move> &searchMoves) {
+    Move ttMove = NULL_MOVE;
+    TranspositionEntry entry;
+    if (transpositionTable.tableLookup(board.currentZobristKey, entry))
+        ttMove = TranspositionTable::decodeMove(board, entry.moveBits);
+
+    ArrayVec<Move, 218> moves = Movegen::generateAllLegalMovesOnBoard(board);
+    orderMoves(moves, 0, nullptr, ttMove);
+
+    std::vector<RootMove> rootMoves;
+    for (int i = 0; i < moves.elements; i++) {
+        Move move = moves.buffer[i];
+        if (!searchMoves.empty() && std::find(searchMoves.begin(), searchMoves.end(), move) == searchMoves.end())
+            continue;
 
-        // For helper threads, rotate the top N moves based on thread ID
-        int rotationCount = threadWorkerInfoPtr->threadNumber % std::min(4, static_cast<int>(moveVector.elements));
-        if (rotationCount > 0) {
-            // Only rotate among the top few moves (the most promising ones)
-            int topMovesToConsider = std::min(static_cast<int>(moveVector.elements), 4 + threadWorkerInfoPtr->threadNumber % 3);
+        if (!board.move(move))
+            continue;
+        board.undoMove(move);
+        rootMoves.emplace_back(move);
+    }
+    return rootMoves;
+}
 
-            // Shift the top moves by the rotation count
-            std::rotate(
-                moveVector.buffer.begin(),
-                moveVector.buffer.begin() + rotationCount % topMovesToConsider,
-                moveVector.buffer.begin() + topMovesToConsider
-            );
+int Search::continuationDepth(Board &board, std::vector<RootMove> &rootMoves, bool &expectedLineFound) {
+    expectedLineFound = false;
+    bool samePosition = board.currentZobristKey == lastRootKey;
+    bool child = board.moveNumber > 0 && board.zobristHistory[board.moveNumber - 1] == lastRootKey;
+    TranspositionEntry entry;
+    if (lastRootKey == 0 || rootMoves.empty() || !(samePosition || child) ||
+        !transpositionTable.tableLookup(board.currentZobristKey, entry))
+        return 1;
+
+    // Every child was searched as part of the last iterations, the TT entry of the new root tells how deep
+    std::vector<Move> expectedLine;
+    if (samePosition)
+        expectedLine = lastPrincipalVariation;
+    else if (board.currentZobristKey == lastPrincipalVariationChildKey)
+        expectedLine.assign(lastPrincipalVariation.begin() + 1, lastPrincipalVariation.end());
+
+    if (!expectedLine.empty()) {
+        auto it = std::find_if(rootMoves.begin(), rootMoves.end(), [&](const RootMove &rootMove) {
+            return rootMove.move == expectedLine[0];
+        });
+        if (it != rootMoves.end()) {
+            std::rotate(rootMoves.begin(), it, it + 1);
+            rootMoves[0].pv = expectedLine;
+            rootMoves[0].score = TranspositionTable::correctScoreForRetrieval(entry.score, 0);
+            expectedLineFound = true;
         }
     }
+
+    return std::clamp(static_cast<int>(entry.depthSearched), 1, 255);
+}
+
+bool Search::saveTranspositionTable(const std::string &path) {
+    return transpositionTable.save(path, lastRootKey);
+}
+
+bool Search::loadTranspositionTable(const std::string &path) {
+    uint64_t rootKey;
+    if (!transpositionTable.load(path, rootKey))
+        return false;
+
+    // The line of the saved search is not stored, only its depth can be continued
+    lastRootKey = rootKey;
+    lastPrincipalVariation.clear();
+    lastPrincipalVariationChildKey = 0;
+    return true;
+}
+
+void Search::sortRootMoves(ThreadWorkerInfo *threadWorkerInfoPtr, int first, int last) {
+    std::vector<RootMove> &rootMoves = threadWorkerInfoPtr->rootMoves;
+    last = std::min(last, static_cast<int>(rootMoves.size()));
+    if (first >= last)
+        return;
+
+    // Stable so that moves with equal results keep the order of the previous iteration
+    std::stable_sort(rootMoves.begin() + first, rootMoves.begin() + last, [](const RootMove &a, const RootMove &b) {
+        return a.score != b.score ? a.score > b.score : a.previousScore > b.previousScore;
+    });
+}
+
+void Search::updatePrincipalVariation(ThreadWorkerInfo *threadWorkerInfoPtr, Move move, int rootDepth) {
+    Move *line = threadWorkerInfoPtr->pvTable[rootDepth];
+    const Move *childLine = threadWorkerInfoPtr->pvTable[rootDepth + 1];
+    int childLength = threadWorkerInfoPtr->pvLength[rootDepth + 1];
+
+    line[rootDepth] = move;
+    for (int ply = rootDepth + 1; ply < childLength; ply++) {
+        line[ply] = childLine[ply];
+    }
+    threadWorkerInfoPtr->pvLength[rootDepth] = std::max(childLength, rootDepth + 1);
+}
+
+std::vector<RootMove> Search::getPrincipalVariations() {
+    std::lock_guard lock(principalVariationsMutex);
+    return principalVariations;
+}
+
+Move Search::getPonderMove() {
+    std::lock_guard lock(principalVariationsMutex);
+    if (principalVariations.empty() || principalVariations[0].pv.size() < 2 ||
+        principalVariations[0].move != bestMove)
+        return NULL_MOVE;
+    return principalVariations[0].pv[1];
+}
+
+std::string Search::principalVariationToSan(Board board, const std::vector<Move> &pv) {
+    std::string san;
+    for (const Move &move: pv) {
+        if (!san.empty())
+            san += " ";
+        san += StandardAlgebraicNotation::boardToSan(board, move);
+        if (!board.move(move))
+            break;
+    }
+    return san;
 }
 
 void Search::threadSearch(ThreadWorkerInfo *info) {
-    for (info->depthToSearch = 1; info->depthToSearch < 256; info->depthToSearch++) {
-        SearchResult result = search(info->board, info, info->depthToSearch);
+    CpuTopology::pinCurrentThread(info->threadNumber);
+
+    if (info->rootMoves.empty())
+        return;
+
+    for (; info->depthToSearch < 256; info->depthToSearch++) {
+        for (RootMove &rootMove: info->rootMoves) {
+            rootMove.previousScore = rootMove.score;
+        }
+
+        // Every line is searched with the lines before it excluded from the root
+        int lines = std::clamp(MULTI_PV, 1, static_cast<int>(info->rootMoves.size()));
+        for (info->pvIndex = 0; info->pvIndex < lines; info->pvIndex++) {
+            int previousScore = info->rootMoves[info->pvIndex].previousScore;
+            if (USE_MTDF)
+                mtdfSearch(info->board, info, info->depthToSearch, previousScore);
+            else
+                aspirationSearch(info->board, info, info->depthToSearch, previousScore);
+            if (searchCancelled)
+                break;
+            sortRootMoves(info, 0, info->pvIndex + 1);
+        }
 
         if (searchCancelled)
             break;
 
         if (info->threadNumber == 0) {
-            currentEval = result.evaluation;
+            const RootMove &best = info->rootMoves[0];
+            currentEval = best.score;
             currentDepth = info->depthToSearch;
-            bestMove = result.bestMove;
-            times[currentDepth] = getMillisSinceEpoch() - currentTimeMillis;
+            bool bestMoveChanged = bestMove != best.move;
+            bestMove = best.move;
+            times[currentDepth] = TimeManager::elapsed();
             timesFloat[currentDepth] = static_cast<float>(times[currentDepth]);
             depths[currentDepth] = static_cast<float>(currentDepth);
             evaluations[info->board.moveNumber] = static_cast<float>(currentEval) / 100.F * static_cast<float>(lastSearchTurnIsWhite ? 1 : -1);
 
+            {
+                std::lock_guard lock(principalVariationsMutex);
+                principalVariations.assign(info->rootMoves.begin(), info->rootMoves.begin() + lines);
+            }
+
             std::cout << currentDepth << ":" << std::to_string(currentEval) << ":" << std::to_string(bestMove.from) <<
                     "," << std::to_string(bestMove.to) << ":" << StandardAlgebraicNotation::boardToSan(
-                        info->board, bestMove) <<
+                        info->board, bestMove) << ":" << principalVariationToSan(info->board, best.pv) <<
                     std::endl;
+            for (int line = 1; line < lines; line++) {
+                std::cout << "  multipv " << line + 1 << " " << info->rootMoves[line].score << " " <<
+                        principalVariationToSan(info->board, info->rootMoves[line].pv) << std::endl;
+            }
+
+            double bestMoveNodes = info->nodes > 0
+                                       ? static_cast<double>(best.nodes) / static_cast<double>(info->nodes)
+                                       : 0;
+            if (TimeManager::shouldStopIteration(currentDepth, bestMoveChanged, currentEval, bestMoveNodes))
+                searchCancelled = true;
         }
     }
 }
 
 
+void Search::cancelAndWait(const std::atomic<bool> &running) {
+    while (running) {
+        searchCancelled = true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
 void Search::startIterativeSearch(Board &board, long time) {
+    TimeControl timeControl;
+    timeControl.moveTime = time;
+    startIterativeSearch(board, timeControl);
+}
+
+void Search::startIterativeSearch(Board &board, const TimeControl &timeControl, const std::vector<Move> &searchMoves) {
+    transpositionTable.allocateIfNeeded();
+    TimeManager::start(timeControl);
+
     std::memset(&times, 0, sizeof(times));
     std::memset(&timesFloat, 0, sizeof(timesFloat));
     std::memset(&depths, 0, sizeof(depths));
 
     nullPrunes = 0;
     searchCancelled = false;
-    searchDuration = time;
     nodesCounted = 0;
     transpositionTable.cutoffs = 0;
+    transpositionTable.newSearch();
     lastSearchTurnIsWhite = board.whiteToMove;
-    currentTimeMillis = getMillisSinceEpoch();
+    {
+        std::lock_guard lock(principalVariationsMutex);
+        principalVariations.clear();
+    }
 
-    // Lookup in opening book
-    Move move = OpeningBook::fetchNextBookMove(board);
+    // Lookup in opening book, unless several lines or a restricted set of moves were asked for
+    Move move = MULTI_PV == 1 && searchMoves.empty() ? OpeningBook::fetchNextBookMove(board) : NULL_MOVE;
     if (!isNullMove(move)) {
         bestMove = move;
         currentEval = 0;
         std::cout << "1:" << std::to_string(currentEval) << ":" << std::to_string(bestMove.from) << "," <<
                 std::to_string(bestMove.to) << ":" << StandardAlgebraicNotation::boardToSan(board, bestMove) <<
                 std::endl;
+        TimeManager::pondering = false;
         return;
     }
 
+    std::vector<RootMove> rootMoves = generateRootMoves(board, searchMoves);
+    bool expectedLineFound = false;
+    int startDepth = timeControl.infinite ? continuationDepth(board, rootMoves, expectedLineFound) : 1;
+    if (startDepth > 1 && expectedLineFound) {
+        // Show the continued line right away, the first iteration at this depth can take a while
+        bestMove = rootMoves[0].move;
+        currentEval = rootMoves[0].score;
+        currentDepth = startDepth;
+        std::lock_guard lock(principalVariationsMutex);
+        principalVariations = {rootMoves[0]};
+    }
+
     std::vector<std::thread> threads;
     threads.reserve(MAX_THREADS);
 
@@ -124,25 +329,39 @@ void Search::startIterativeSearch(Board &board, long time) {
     threadWorkerInfos.reserve(MAX_THREADS);
 
     for (int threadNumber = 0; threadNumber < MAX_THREADS; threadNumber++) {
-        threadWorkerInfos.emplace_back(std::make_unique<ThreadWorkerInfo>(threadNumber, currentDepth));
+        threadWorkerInfos.emplace_back(std::make_unique<ThreadWorkerInfo>(threadNumber, startDepth));
 
         ThreadWorkerInfo *infoPtr = threadWorkerInfos[threadNumber].get();
         memcpy(&infoPtr->board, &board, sizeof(Board));
+        infoPtr->rootMoves = rootMoves;
         threads.emplace_back(threadSearch, infoPtr);
     }
 
     for (auto &t: threads) {
         if (t.joinable()) t.join();
     }
+    TimeManager::pondering = false;
+
+    {
+        std::lock_guard lock(principalVariationsMutex);
+        if (!principalVariations.empty() && !principalVariations[0].pv.empty()) {
+            lastRootKey = board.currentZobristKey;
+            lastPrincipalVariation = principalVariations[0].pv;
+            Board child = board;
+            lastPrincipalVariationChildKey = child.move(lastPrincipalVariation[0]) ? child.currentZobristKey : 0;
+        }
+    }
+
+    for (const auto &info: threadWorkerInfos) {
+        nodesCounted += info->nodes;
+    }
+    long elapsed = TimeManager::elapsed();
+    nodesPerSecond = elapsed > 0 ? static_cast<double>(nodesCounted) * 1000.0 / static_cast<double>(elapsed) : 0;
 }
 
 SearchResult Search::search(Board &board, ThreadWorkerInfo *threadWorkerInfoPtr, int rootDepth, int depth, int alpha,
-                            int beta, bool wasNullSearch, bool inPrincipalVariation) {
-    nodesCounted++;
-
-    // Checkup to see search duration is over
-    if ((nodesCounted & 2047) == 0 && getMillisSinceEpoch() - currentTimeMillis >= searchDuration)
-        searchCancelled = true;
+                            int beta, bool wasNullSearch, bool inPrincipalVariation, bool cutNode) {
+    threadWorkerInfoPtr->pvLength[rootDepth] = rootDepth;
 
     if (searchCancelled)
         return {0, NULL_MOVE};
@@ -157,42 +376,84 @@ SearchResult Search::search(Board &board, ThreadWorkerInfo *threadWorkerInfoPtr,
             return {alpha, NULL_MOVE};
     }
 
-    if (depth <= 0)
-        return {quiesce(board, alpha, beta), NULL_MOVE};
+    // Quiescence counts its own nodes
+    if (depth <= 0 || rootDepth >= MAX_PLY - 1)
+        return {quiesce(board, threadWorkerInfoPtr, rootDepth, alpha, beta), NULL_MOVE};
+
+    if (countNode(threadWorkerInfoPtr))
+        return {0, NULL_MOVE};
+
+    Move excludedMove = threadWorkerInfoPtr->excludedMoves[rootDepth];
+    bool excluding = !isNullMove(excludedMove);
 
     TranspositionEntry entry;
     Move lookupBestMove;
+    int ttDepth = -1;
+    int ttNodeType = UPPER_BOUND;
+    int ttScore = 0;
+    int ttStaticEval = TranspositionEntry::NO_STATIC_EVAL;
     if (transpositionTable.tableLookup(board.currentZobristKey, entry)) {
-        uint64_t moveBits = EXTRACT_BEST_MOVE_BITS(entry.data);
-        GET_MOVE_FROM_BITS(moveBits, lookupBestMove);
-
-        int depthSearched = EXTRACT_DEPTH_SEARCHED(entry.data);
-        int nodeType = EXTRACT_NODE_TYPE(entry.data);
-        int score = EXTRACT_SCORE(entry.data);
-        if (depthSearched >= depth && !searchCancelled && !inPrincipalVariation) {
-            int correctedScore = transpositionTable.correctScoreForRetrieval(score, rootDepth);
-            if (nodeType == EXACT_BOUND) {
-                transpositionTable.cutoffs++;
-                return {correctedScore, lookupBestMove};
-            }
-            if (nodeType == UPPER_BOUND && score <= alpha) {
-                transpositionTable.cutoffs++;
-                return {alpha, lookupBestMove};
-            }
-            if (nodeType == LOWER_BOUND && score >= beta) {
+        lookupBestMove = TranspositionTable::decodeMove(board, entry.moveBits);
+
+        int depthSearched = entry.depthSearched;
+        int nodeType = entry.nodeType();
+        ttDepth = depthSearched;
+        ttNodeType = nodeType;
+        ttScore = transpositionTable.correctScoreForRetrieval(entry.score, rootDepth);
+        ttStaticEval = entry.staticEval;
+        // The root is never cut, its moves have to be searched to be ranked
+        if (depthSearched >= depth && !searchCancelled && rootDepth > 0 && !inPrincipalVariation && !excluding) {
+            // Fail-soft: the stored bound itself is returned, it is at least as tight as alpha or beta
+            if (nodeType == EXACT_BOUND ||
+                (nodeType == UPPER_BOUND && ttScore <= alpha) ||
+                (nodeType == LOWER_BOUND && ttScore >= beta)) {
                 transpositionTable.cutoffs++;
-                return {beta, lookupBestMove};
+                return {ttScore, lookupBestMove};
             }
         }
     }
 
-    // Null Move Pruning
-    if (!inPrincipalVariation && rootDepth && depth >= 3 && !wasNullSearch && canNullMove(board) && !Movegen::isKingInDanger(board, board.whiteToMove)) {
-        int reduction = 2 + depth / 4;
+    // The uncorrected eval is what goes into the table, a hit saves evaluating the position again
+    bool inCheck = Movegen::isKingInDanger(board, board.whiteToMove);
+    int rawStaticEval = NO_EVAL;
+    if (!inCheck)
+        rawStaticEval = ttStaticEval != TranspositionEntry::NO_STATIC_EVAL ? ttStaticEval
+                                                                            : cachedEvaluate(threadWorkerInfoPtr, board);
+    int staticEval = inCheck ? NO_EVAL : correctStaticEval(threadWorkerInfoPtr, board, rawStaticEval);
+    threadWorkerInfoPtr->staticEvals[rootDepth] = staticEval;
+
+    // The side to move is doing better than it was a full move ago
+    bool improving = !inCheck && rootDepth >= 2 && (threadWorkerInfoPtr->staticEvals[rootDepth - 2] == NO_EVAL ||
+                                                    staticEval > threadWorkerInfoPtr->staticEvals[rootDepth - 2]);
+
+    bool pvNode = beta - alpha > 1;
+    bool canPrune = rootDepth > 0 && !pvNode && !inCheck && !excluding;
+
+    // Reverse Futility Pruning
+    if (ENABLE_REVERSE_FUTILITY_PRUNING && canPrune && depth <= REVERSE_FUTILITY_MAX_DEPTH &&
+        abs(beta) < MATE_THRESHOLD && staticEval - REVERSE_FUTILITY_MARGIN * (depth - improving) >= beta) {
+        return {staticEval, NULL_MOVE};
+    }
 
+    // Razoring
+    if (ENABLE_RAZORING && canPrune && depth <= RAZORING_MAX_DEPTH && staticEval + RAZORING_MARGIN * depth < alpha) {
+        int score = quiesce(board, threadWorkerInfoPtr, rootDepth, alpha, alpha + 1);
+        if (score <= alpha)
+            return {score, NULL_MOVE};
+    }
+
+    // Null Move Pruning
+    if (ENABLE_NULL_MOVE_PRUNING && !inPrincipalVariation && rootDepth && depth >= NULL_MOVE_MIN_DEPTH &&
+        !wasNullSearch && !excluding && !inCheck && staticEval >= beta && abs(beta) < MATE_THRESHOLD &&
+        rootDepth >= threadWorkerInfoPtr->nullMoveMinPly && canNullMove(board)) {
+        // The further the eval is above beta, the less depth the refutation needs
+        int reduction = NULL_MOVE_BASE_REDUCTION + depth / NULL_MOVE_DEPTH_DIVISOR +
+                        std::min((staticEval - beta) / NULL_MOVE_EVAL_DIVISOR, NULL_MOVE_MAX_EVAL_REDUCTION);
+
+        threadWorkerInfoPtr->moveStack[rootDepth] = NULL_MOVE;
         board.nullMove();
         SearchResult result = search(board, threadWorkerInfoPtr, rootDepth + 1, depth - 1 - reduction, -beta, -beta + 1,
-                                     true, inPrincipalVariation);
+                                     true, inPrincipalVariation, !cutNode);
         int negatedScore = -result.evaluation;
         board.undoNullMove();
 
@@ -200,124 +461,589 @@ SearchResult Search::search(Board &board, ThreadWorkerInfo *threadWorkerInfoPtr,
             return {0, NULL_MOVE};
 
         if (negatedScore >= beta && abs(negatedScore) < MATE_THRESHOLD) {
-            nullPrunes++;
-            return {negatedScore, NULL_MOVE};
+            if (depth < NULL_MOVE_VERIFICATION_DEPTH || threadWorkerInfoPtr->nullMoveMinPly > 0) {
+                nullPrunes++;
+                return {negatedScore, NULL_MOVE};
+            }
+
+            // Verification search: in a zugzwang the null move fails high only because passing is the best move, so
+            // the cutoff is confirmed by a reduced search of the real moves with null moves disabled for a while
+            threadWorkerInfoPtr->nullMoveMinPly = rootDepth + 3 * (depth - reduction) / 4;
+            int verification = search(board, threadWorkerInfoPtr, rootDepth, depth - reduction, beta - 1, beta, false,
+                                      false, false).evaluation;
+            threadWorkerInfoPtr->nullMoveMinPly = 0;
+
+            if (searchCancelled)
+                return {0, NULL_MOVE};
+
+            if (verification >= beta) {
+                nullPrunes++;
+                return {negatedScore, NULL_MOVE};
+            }
+        }
+    }
+
+    // ProbCut
+    int probCutBeta = beta + PROBCUT_MARGIN;
+    if (ENABLE_PROBCUT && canPrune && depth >= PROBCUT_MIN_DEPTH && abs(beta) < MATE_THRESHOLD &&
+        !(ttDepth >= depth - PROBCUT_DEPTH_REDUCTION + 1 && ttScore < probCutBeta)) {
+        ArrayVec<Move, 218> captures = Movegen::generateAllLegalMovesOnBoard(board, true, false);
+        orderMoves(captures, rootDepth, threadWorkerInfoPtr, lookupBestMove);
+
+        for (int i = 0; i < captures.elements; i++) {
+            Move move = captures.buffer[i];
+            if (!staticExchangeEvaluation(board, move, probCutBeta - staticEval))
+                continue;
+
+            if (!board.move(move))
+                continue;
+
+            threadWorkerInfoPtr->moveStack[rootDepth] = move;
+
+            // Cheap quiescence check first, only captures that hold there get the reduced search
+            int score = -quiesce(board, threadWorkerInfoPtr, rootDepth + 1, -probCutBeta, -probCutBeta + 1);
+            if (score >= probCutBeta) {
+                score = -search(board, threadWorkerInfoPtr, rootDepth + 1, depth - PROBCUT_DEPTH_REDUCTION,
+                                -probCutBeta, -probCutBeta + 1, wasNullSearch, false, !cutNode).evaluation;
+            }
+            board.undoMove(move);
+
+            if (searchCancelled)
+                return {0, NULL_MOVE};
+
+            if (score >= probCutBeta) {
+                transpositionTable.addEntry(board.currentZobristKey, move, rootDepth,
+                                            depth - PROBCUT_DEPTH_REDUCTION + 1, score, LOWER_BOUND, rawStaticEval);
+                return {score, move};
+            }
         }
     }
 
+    // Internal Iterative Reduction
+    if (ENABLE_INTERNAL_ITERATIVE_REDUCTION && rootDepth > 0 && (pvNode || cutNode) && !excluding &&
+        depth >= INTERNAL_ITERATIVE_REDUCTION_MIN_DEPTH && isNullMove(lookupBestMove)) {
+        depth--;
+    }
+
     int nodeType = UPPER_BOUND;
     bool movesAvailable = false;
     Move bestMove = lookupBestMove;
+    int bestScore = NEGATIVE_INFINITY;
 
-    ArrayVec<Move, 218> moves = Movegen::generateAllLegalMovesOnBoard(board);
-
-    orderMoves(moves, rootDepth, threadWorkerInfoPtr, bestMove, depth); // Order moves for better pruning
+    ArrayVec<Move, 218> moves(0);
+    if (rootDepth == 0) {
+        // The root keeps the order of the previous iteration and skips the MultiPV lines already searched
+        for (size_t i = threadWorkerInfoPtr->pvIndex; i < threadWorkerInfoPtr->rootMoves.size(); i++) {
+            moves.buffer[moves.elements++] = threadWorkerInfoPtr->rootMoves[i].move;
+        }
+        diversifyRootMoves(moves, threadWorkerInfoPtr);
+    } else {
+        moves = Movegen::generateAllLegalMovesOnBoard(board);
+        orderMoves(moves, rootDepth, threadWorkerInfoPtr, bestMove); // Order moves for better pruning
+    }
     bool firstMove = true;
     int moved = 0;
+    Move quietsSearched[64];
+    int quietCount = 0;
     for (int i = 0; i < moves.elements; i++) {
         if (searchCancelled)
             return {0, NULL_MOVE};
         Move move = moves.buffer[i];
 
+        if (excluding && move == excludedMove)
+            continue;
+
+        int extension = 0;
+        bool canExtend = rootDepth < 2 * threadWorkerInfoPtr->depthToSearch;
+
+        // Singular Extension
+        if (ENABLE_SINGULAR_EXTENSIONS && canExtend && rootDepth > 0 && !excluding && move == lookupBestMove &&
+            depth >= SINGULAR_MIN_DEPTH && ttDepth >= depth - SINGULAR_TT_DEPTH_MARGIN && ttNodeType != UPPER_BOUND &&
+            abs(ttScore) < MATE_THRESHOLD) {
+            int singularBeta = ttScore - SINGULAR_MARGIN * depth;
+
+            threadWorkerInfoPtr->excludedMoves[rootDepth] = move;
+            int singularScore = search(board, threadWorkerInfoPtr, rootDepth, (depth - 1) / 2, singularBeta - 1,
+                                       singularBeta, wasNullSearch, false, cutNode).evaluation;
+            threadWorkerInfoPtr->excludedMoves[rootDepth] = NULL_MOVE;
+
+            if (searchCancelled)
+                return {0, NULL_MOVE};
+
+            if (singularScore < singularBeta) {
+                extension = 1;
+            } else if (singularBeta >= beta) {
+                // Multi-cut: another move beats beta even without the TT move
+                return {singularBeta, lookupBestMove};
+            }
+        }
+
         if (!board.move(move))
             continue;
 
         movesAvailable = true;
-        int negatedScore = negatedPrincipalVariationSearch(board, threadWorkerInfoPtr, move, firstMove, moved,
-                                                           rootDepth, depth, alpha, beta,
-                                                           wasNullSearch, !rootDepth && firstMove);
+        bool givesCheck = Movegen::isKingInDanger(board, board.whiteToMove);
+
+        // Check Extension
+        if (ENABLE_CHECK_EXTENSIONS && canExtend && givesCheck)
+            extension = 1;
+
+        if (canPrune && moved > 0 && isQuiet(move) && !givesCheck && alpha > -MATE_THRESHOLD) {
+            // Futility Pruning
+            if (ENABLE_FUTILITY_PRUNING && depth <= FUTILITY_MAX_DEPTH &&
+                staticEval + FUTILITY_BASE + FUTILITY_MARGIN * depth <= alpha) {
+                board.undoMove(move);
+                continue;
+            }
+
+            // Late Move Pruning
+            if (ENABLE_LATE_MOVE_PRUNING && depth <= LATE_MOVE_PRUNING_MAX_DEPTH &&
+                quietCount >= (LATE_MOVE_PRUNING_BASE + depth * depth) / (improving ? 1 : 2)) {
+                board.undoMove(move);
+                continue;
+            }
+        }
+
+        int reduction = inCheck || givesCheck
+                            ? 0
+                            : lateMoveReduction(threadWorkerInfoPtr, move, moved, rootDepth, depth, pvNode, cutNode,
+                                                improving);
+
+        threadWorkerInfoPtr->moveStack[rootDepth] = move;
+        long nodesBefore = threadWorkerInfoPtr->nodes;
+        int negatedScore = negatedPrincipalVariationSearch(board, threadWorkerInfoPtr, firstMove, rootDepth,
+                                                           depth + extension, alpha, beta, wasNullSearch,
+                                                           inPrincipalVariation && firstMove, cutNode, reduction);
         board.undoMove(move);
+
+        if (rootDepth == 0 && !searchCancelled) {
+            RootMove &rootMove = *std::find_if(threadWorkerInfoPtr->rootMoves.begin(),
+                                               threadWorkerInfoPtr->rootMoves.end(),
+                                               [&](const RootMove &candidate) { return candidate.move == move; });
+            rootMove.nodes += threadWorkerInfoPtr->nodes - nodesBefore;
+
+            if (moved == 0 || negatedScore > alpha) {
+                rootMove.score = negatedScore;
+                rootMove.pv.assign(1, move);
+                rootMove.pv.insert(rootMove.pv.end(), threadWorkerInfoPtr->pvTable[1] + 1,
+                                   threadWorkerInfoPtr->pvTable[1] + threadWorkerInfoPtr->pvLength[1]);
+            } else {
+                // Only known to be worse than the best move, sort it behind every move with a real score
+                rootMove.score = NEGATIVE_INFINITY;
+            }
+        }
         moved++;
 
         // Alpha-beta pruning
-        if (negatedScore > alpha) {
-            alpha = negatedScore;
-            bestMove = move;
-            nodeType = EXACT_BOUND;
+        if (negatedScore > bestScore) {
+            bestScore = negatedScore;
+            if (negatedScore > alpha) {
+                alpha = negatedScore;
+                bestMove = move;
+                nodeType = EXACT_BOUND;
+                if (pvNode)
+                    updatePrincipalVariation(threadWorkerInfoPtr, move, rootDepth);
+            }
         }
 
         if (alpha >= beta) {
-            storeKillerMove(threadWorkerInfoPtr, move, depth);
-            transpositionTable.addEntry(board.currentZobristKey, bestMove, rootDepth, depth, beta, LOWER_BOUND);
-            return {beta, bestMove};
+            if (isQuiet(move)) {
+                storeKillerMove(threadWorkerInfoPtr, move, rootDepth);
+                updateQuietHistories(threadWorkerInfoPtr, move, quietsSearched, quietCount, rootDepth, depth);
+            }
+            if (!excluding && !searchCancelled) {
+                if (!inCheck && isQuiet(bestMove) && bestScore > staticEval)
+                    updateCorrectionHistory(threadWorkerInfoPtr, board, depth, bestScore, staticEval);
+                transpositionTable.addEntry(board.currentZobristKey, bestMove, rootDepth, depth, bestScore, LOWER_BOUND,
+                                            rawStaticEval);
+            }
+            return {bestScore, bestMove};
         }
+
+        if (isQuiet(move) && quietCount < 64)
+            quietsSearched[quietCount++] = move;
     }
 
-    if (!movesAvailable) {
-        alpha = Movegen::isKingInDanger(board, board.whiteToMove) ? NEGATIVE_INFINITY + rootDepth : 0;
+    if (!movesAvailable && !excluding) {
+        bestScore = inCheck ? NEGATIVE_INFINITY + rootDepth : 0;
+    } else if (moved == 0) {
+        // Every move was pruned, or the only legal move is the excluded one, so the node fails low
+        bestScore = alpha;
     }
 
-    if (!searchCancelled) {
-        transpositionTable.addEntry(board.currentZobristKey, bestMove, rootDepth, depth, alpha, nodeType);
+    if (!searchCancelled && !excluding) {
+        // An upper bound above the static eval or an exact score decided by a capture says nothing about the eval
+        if (!inCheck && movesAvailable && (nodeType == EXACT_BOUND ? isQuiet(bestMove) : bestScore < staticEval))
+            updateCorrectionHistory(threadWorkerInfoPtr, board, depth, bestScore, staticEval);
+        transpositionTable.addEntry(board.currentZobristKey, bestMove, rootDepth, depth, bestScore, nodeType,
+                                    rawStaticEval);
     }
-    return {alpha, bestMove};
+    return {bestScore, bestMove};
 }
 
-int Search::negatedPrincipalVariationSearch(Board &board, ThreadWorkerInfo *threadWorkerInfoPtr, Move move,
-                                            bool &firstMove, int moved, int rootDepth,
-                                            int depth, int alpha, int beta, bool wasNullSearch,
-                                            bool inPrincipalVariation) {
+int Search::negatedPrincipalVariationSearch(Board &board, ThreadWorkerInfo *threadWorkerInfoPtr, bool &firstMove,
+                                            int rootDepth, int depth, int alpha, int beta, bool wasNullSearch,
+                                            bool inPrincipalVariation, bool cutNode, int reduction) {
     int negatedScore;
-
-    if (depth > 3 && move.capture == NONE && move.promotion == NONE && moved > 4) {
-        negatedScore = -search(board, threadWorkerInfoPtr, rootDepth + 1, depth - 2, -alpha - 1, -alpha, wasNullSearch,
-                               inPrincipalVariation).evaluation;
-        if (negatedScore <= alpha) {
-            return negatedScore;
-        }
-    }
+    bool pvNode = beta - alpha > 1;
 
     if (firstMove) {
         // Full window search for the first move
         negatedScore = -search(board, threadWorkerInfoPtr, rootDepth + 1, depth - 1, -beta, -alpha, wasNullSearch,
-                               inPrincipalVariation).evaluation;
+                               inPrincipalVariation, !pvNode && !cutNode).evaluation;
         firstMove = false;
-    } else {
-        // Principal Variation Search: try a null window search first
-        negatedScore = -search(board, threadWorkerInfoPtr, rootDepth + 1, depth - 1, -alpha - 1, -alpha, wasNullSearch,
-                               inPrincipalVariation).evaluation;
+        return negatedScore;
+    }
 
-        // If null window search fails high, do a full research
-        if (negatedScore > alpha && negatedScore < beta) {
-            negatedScore = -search(board, threadWorkerInfoPtr, rootDepth + 1, depth - 1, -beta, -alpha, wasNullSearch,
-                                   true).evaluation;
-        }
+    // Later moves of a PV node are expected to fail low, so their null window children are cut nodes
+    bool childCutNode = pvNode || !cutNode;
+
+    // Principal Variation Search: try a null window search first
+    negatedScore = -search(board, threadWorkerInfoPtr, rootDepth + 1, depth - 1 - reduction, -alpha - 1, -alpha,
+                           wasNullSearch, inPrincipalVariation, childCutNode).evaluation;
+
+    // A reduced move that beats alpha is verified at full depth before it is trusted
+    if (negatedScore > alpha && reduction > 0) {
+        negatedScore = -search(board, threadWorkerInfoPtr, rootDepth + 1, depth - 1, -alpha - 1, -alpha,
+                               wasNullSearch, inPrincipalVariation, !childCutNode).evaluation;
+    }
+
+    // If null window search fails high, do a full research
+    if (negatedScore > alpha && negatedScore < beta) {
+        negatedScore = -search(board, threadWorkerInfoPtr, rootDepth + 1, depth - 1, -beta, -alpha, wasNullSearch,
+                               true, false).evaluation;
     }
     return negatedScore;
 }
 
+void Search::initializeLateMoveReductionTable() {
+    LATE_MOVE_REDUCTIONS[0][0] = 0;
+    for (int depth = 1; depth < 64; depth++) {
+        for (int moveNumber = 1; moveNumber < 64; moveNumber++) {
+            LATE_MOVE_REDUCTIONS[depth][moveNumber] = static_cast<int>(
+                LMR_BASE + std::log(depth) * std::log(moveNumber) / LMR_DIVISOR);
+        }
+    }
+}
+
+int Search::lateMoveReduction(ThreadWorkerInfo *threadWorkerInfoPtr, Move move, int moved, int rootDepth, int depth,
+                              bool pvNode, bool cutNode, bool improving) {
+    if (depth < LMR_MIN_DEPTH || moved < LMR_MIN_MOVES + pvNode || !isQuiet(move))
+        return 0;
+
+    int reduction = LATE_MOVE_REDUCTIONS[std::min(depth, 63)][std::min(moved + 1, 63)];
+
+    if (pvNode)
+        reduction--;
+    if (cutNode)
+        reduction++;
+    if (!improving)
+        reduction++;
+
+    reduction -= historyScore(threadWorkerInfoPtr, move, rootDepth) / LMR_HISTORY_DIVISOR;
+
+    // Always leave at least one ply for the reduced search
+    return std::clamp(reduction, 0, depth - 2);
+}
+
 bool Search::canNullMove(Board &board) {
     return __builtin_popcountll(board.majorPieceBitboards(board.whiteToMove));
 }
 
 SearchResult Search::search(Board &board, ThreadWorkerInfo *threadWorkerInfoPtr, int depth) {
-    return search(board, threadWorkerInfoPtr, 0, depth, NEGATIVE_INFINITY, POSITIVE_INFINITY, false, true);
+    return search(board, threadWorkerInfoPtr, depth, NEGATIVE_INFINITY, POSITIVE_INFINITY);
+}
+
+SearchResult Search::search(Board &board, ThreadWorkerInfo *threadWorkerInfoPtr, int depth, int alpha, int beta) {
+    return search(board, threadWorkerInfoPtr, 0, depth, alpha, beta, false, true, false);
 }
 
-int Search::quiesce(Board &board, int alpha, int beta) {
-    int standingPat = evaluate(board);
-    if (standingPat >= beta)
-        return beta;
-    if (alpha < standingPat)
-        alpha = standingPat;
+SearchResult Search::aspirationSearch(Board &board, ThreadWorkerInfo *threadWorkerInfoPtr, int depth,
+                                      int previousScore) {
+    int first = threadWorkerInfoPtr->pvIndex;
+    int last = static_cast<int>(threadWorkerInfoPtr->rootMoves.size());
 
+    if (depth < ASPIRATION_MIN_DEPTH || abs(previousScore) >= MATE_THRESHOLD) {
+        SearchResult result = search(board, threadWorkerInfoPtr, depth);
+        if (!searchCancelled)
+            sortRootMoves(threadWorkerInfoPtr, first, last);
+        return result;
+    }
 
-    ArrayVec<Move, 218> captures = Movegen::generateAllLegalMovesOnBoard(board, true, false);
-    orderMoves(captures, 1, nullptr, NULL_MOVE, 0);
+    int window = ASPIRATION_WINDOW + threadWorkerInfoPtr->threadNumber % 4 * ASPIRATION_HELPER_OFFSET;
+    int alpha = std::max(previousScore - window, static_cast<int>(NEGATIVE_INFINITY));
+    int beta = std::min(previousScore + window, static_cast<int>(POSITIVE_INFINITY));
 
-    for (int i = 0; i < captures.elements; i++) {
-        Move move = captures.buffer.at(i);
+    while (true) {
+        SearchResult result = search(board, threadWorkerInfoPtr, depth, alpha, beta);
+        if (searchCancelled)
+            return result;
+
+        // Bring the best move of a failed window to the front so the re-search starts with it
+        sortRootMoves(threadWorkerInfoPtr, first, last);
+
+        if (result.evaluation <= alpha && alpha > NEGATIVE_INFINITY) {
+            // Fail low: pull beta towards the window center and widen downwards
+            beta = (alpha + beta) / 2;
+            alpha = std::max(result.evaluation - window, static_cast<int>(NEGATIVE_INFINITY));
+        } else if (result.evaluation >= beta && beta < POSITIVE_INFINITY) {
+            beta = std::min(result.evaluation + window, static_cast<int>(POSITIVE_INFINITY));
+        } else {
+            return result;
+        }
 
-        if (board.move(move)) {
-            int score = -quiesce(board, -beta, -alpha);
-            board.undoMove(move);
-            if (score >= beta)
-                return beta;
-            if (score > alpha)
+        window *= 2;
+        if (window > ASPIRATION_MAX_WINDOW) {
+            alpha = NEGATIVE_INFINITY;
+            beta = POSITIVE_INFINITY;
+        }
+    }
+}
+
+SearchResult Search::mtdfSearch(Board &board, ThreadWorkerInfo *threadWorkerInfoPtr, int depth, int firstGuess) {
+    int first = threadWorkerInfoPtr->pvIndex;
+    int last = static_cast<int>(threadWorkerInfoPtr->rootMoves.size());
+
+    int guess = firstGuess <= NEGATIVE_INFINITY ? 0 : firstGuess;
+    int lowerBound = NEGATIVE_INFINITY;
+    int upperBound = POSITIVE_INFINITY;
+
+    // Each zero window search moves one bound to the returned score until they meet, the TT keeps the repeated passes
+    // over the same tree cheap. The passes are not PV searches, so that they can take TT cutoffs below the root
+    SearchResult result;
+    while (lowerBound < upperBound) {
+        int beta = std::max(guess, lowerBound + 1);
+        result = search(board, threadWorkerInfoPtr, 0, depth, beta - 1, beta, false, false, false);
+        if (searchCancelled)
+            return result;
+
+        sortRootMoves(threadWorkerInfoPtr, first, last);
+
+        guess = result.evaluation;
+        if (guess < beta)
+            upperBound = guess;
+        else
+            lowerBound = guess;
+    }
+
+    // Zero window searches never raise alpha at a PV node, so the line is read back from the TT instead
+    RootMove &best = threadWorkerInfoPtr->rootMoves[first];
+    best.pv = principalVariationFromTable(board, best.move, depth);
+    return result;
+}
+
+std::vector<Move> Search::principalVariationFromTable(Board board, Move firstMove, int maxLength) {
+    std::vector<Move> pv;
+    Move move = firstMove;
+    while (static_cast<int>(pv.size()) < maxLength && board.move(move)) {
+        pv.push_back(move);
+        if (board.isDrawn())
+            break;
+
+        TranspositionEntry entry;
+        if (!transpositionTable.tableLookup(board.currentZobristKey, entry))
+            break;
+
+        move = TranspositionTable::decodeMove(board, entry.moveBits);
+
+        // Only follow moves that are legal here, the entry can be stale or belong to a colliding position
+        ArrayVec<Move, 218> moves = Movegen::generateAllLegalMovesOnBoard(board);
+        bool legal = false;
+        for (int i = 0; i < moves.elements && !legal; i++)
+            legal = moves.buffer[i] == move;
+        if (!legal)
+            break;
+    }
+    return pv;
+}
+
+bool Search::countNode(ThreadWorkerInfo *threadWorkerInfoPtr) {
+    threadWorkerInfoPtr->nodes++;
+
+    // Checkup to see search duration is over, every thread looks at the clock based on its own node count
+    if ((threadWorkerInfoPtr->nodes & (TimeManager::NODE_CHECK_INTERVAL - 1)) == 0 && TimeManager::hardLimitReached())
+        searchCancelled = true;
+
+    return searchCancelled;
+}
+
+int Search::quiesce(Board &board, ThreadWorkerInfo *threadWorkerInfoPtr, int rootDepth, int alpha, int beta) {
+    if (countNode(threadWorkerInfoPtr))
+        return 0;
+
+    bool inCheck = Movegen::isKingInDanger(board, board.whiteToMove);
+    if (rootDepth >= MAX_PLY - 1)
+        return inCheck ? 0 : cachedEvaluate(threadWorkerInfoPtr, board);
+
+    Move ttMove = NULL_MOVE;
+    int ttStaticEval = TranspositionEntry::NO_STATIC_EVAL;
+    TranspositionEntry entry;
+    if (transpositionTable.tableLookup(board.currentZobristKey, entry)) {
+        ttMove = TranspositionTable::decodeMove(board, entry.moveBits);
+        ttStaticEval = entry.staticEval;
+
+        // Every entry is at least as deep as quiescence, so any usable bound cuts
+        int nodeType = entry.nodeType();
+        int ttScore = transpositionTable.correctScoreForRetrieval(entry.score, rootDepth);
+        if (nodeType == EXACT_BOUND ||
+            (nodeType == UPPER_BOUND && ttScore <= alpha) ||
+            (nodeType == LOWER_BOUND && ttScore >= beta)) {
+            transpositionTable.cutoffs++;
+            return ttScore;
+        }
+    }
+
+    // In check there is no standing pat, every evasion is searched and having none is mate
+    int standingPat = NO_EVAL;
+    int bestScore = NEGATIVE_INFINITY + rootDepth;
+    if (!inCheck) {
+        standingPat = ttStaticEval != TranspositionEntry::NO_STATIC_EVAL ? ttStaticEval
+                                                                         : cachedEvaluate(threadWorkerInfoPtr, board);
+        if (standingPat >= beta)
+            return standingPat;
+        bestScore = standingPat;
+    }
+
+    int originalAlpha = alpha;
+    if (alpha < bestScore)
+        alpha = bestScore;
+
+    ArrayVec<Move, 218> moves = inCheck
+                                    ? Movegen::generateAllLegalMovesOnBoard(board)
+                                    : Movegen::generateAllLegalMovesOnBoard(board, true, false);
+
+    // Moves are picked one at a time instead of sorted, most nodes cut off after the first capture or two
+    std::array<int, 218> scores{};
+    for (int i = 0; i < moves.elements; i++) {
+        Move move = moves.buffer[i];
+        if (move == ttMove) {
+            scores[i] = TRANSPOSITION_TABLE_BIAS;
+        } else if (move.capture != NONE) {
+            // Most valuable victim first, least valuable attacker among equal victims
+            scores[i] = WINNING_CAPTURE_BIAS + abs(getPieceValue(move.capture)) * 16 -
+                        std::min(abs(getPieceValue(move.pieceFrom)), 1000);
+        } else if (move.promotion != NONE) {
+            scores[i] = PROMOTE_BIAS;
+        }
+    }
+
+    Move bestMove = NULL_MOVE;
+    for (int i = 0; i < moves.elements; i++) {
+        int bestIndex = i;
+        for (int j = i + 1; j < moves.elements; j++) {
+            if (scores[j] > scores[bestIndex])
+                bestIndex = j;
+        }
+        std::swap(moves.buffer[i], moves.buffer[bestIndex]);
+        std::swap(scores[i], scores[bestIndex]);
+        Move move = moves.buffer[i];
+
+        if (!inCheck) {
+            // Delta Pruning: even winning the captured piece outright cannot lift the score to alpha
+            if (ENABLE_DELTA_PRUNING && move.promotion == NONE) {
+                int futilityScore = standingPat + abs(getPieceValue(move.capture)) + DELTA_MARGIN;
+                if (futilityScore <= alpha) {
+                    bestScore = std::max(bestScore, futilityScore);
+                    continue;
+                }
+            }
+
+            // SEE Pruning: captures that lose material in the exchange
+            if (ENABLE_QUIESCENCE_SEE_PRUNING && !staticExchangeEvaluation(board, move, 0))
+                continue;
+        }
+
+        if (!board.move(move))
+            continue;
+
+        int score = -quiesce(board, threadWorkerInfoPtr, rootDepth + 1, -beta, -alpha);
+        board.undoMove(move);
+
+        if (searchCancelled)
+            return 0;
+
+        if (score > bestScore) {
+            bestScore = score;
+            if (score > alpha) {
                 alpha = score;
+                bestMove = move;
+            }
         }
+        if (alpha >= beta)
+            break;
+    }
+
+    int nodeType = bestScore >= beta ? LOWER_BOUND : bestScore > originalAlpha ? EXACT_BOUND : UPPER_BOUND;
+    transpositionTable.addEntry(board.currentZobristKey, bestMove, rootDepth, 0, bestScore, nodeType, standingPat);
+    return bestScore;
+}
+
+uint64_t Search::pawnStructureKey(Board &board) {
+    // Finalizer of MurmurHash3, spreads the pawn bitboards over all bits of the index
+    uint64_t key = board.BITBOARDS[WHITE_PAWN] ^ std::rotl(board.BITBOARDS[BLACK_PAWN], 32) * 0x9E3779B97F4A7C15ULL;
+    key ^= key >> 33;
+    key *= 0xFF51AFD7ED558CCDULL;
+    key ^= key >> 33;
+    key *= 0xC4CEB9FE1A85EC53ULL;
+    key ^= key >> 33;
+    return key;
+}
+
+uint64_t Search::materialKey(Board &board) {
+    uint64_t key = 0;
+    for (int piece = 0; piece < 12; piece++) {
+        key = key << 4 | std::min(std::popcount(board.BITBOARDS[piece]), 15);
     }
-    return alpha;
+    key ^= key >> 33;
+    key *= 0xFF51AFD7ED558CCDULL;
+    key ^= key >> 33;
+    return key;
+}
+
+int Search::correctStaticEval(ThreadWorkerInfo *threadWorkerInfoPtr, Board &board, int rawEval) {
+    if (!ENABLE_CORRECTION_HISTORY)
+        return rawEval;
+
+    int side = board.whiteToMove;
+    int pawnCorrection = threadWorkerInfoPtr->pawnCorrectionHistory[side][
+        pawnStructureKey(board) & (CORRECTION_HISTORY_SIZE - 1)];
+    int materialCorrection = threadWorkerInfoPtr->materialCorrectionHistory[side][
+        materialKey(board) & (CORRECTION_HISTORY_SIZE - 1)];
+
+    int correctedEval = rawEval + (pawnCorrection + materialCorrection) / (2 * CORRECTION_HISTORY_GRAIN);
+    return std::clamp(correctedEval, -MATE_THRESHOLD + 1, MATE_THRESHOLD - 1);
+}
+
+void Search::updateCorrectionHistory(ThreadWorkerInfo *threadWorkerInfoPtr, Board &board, int depth, int bestScore,
+                                     int staticEval) {
+    if (!ENABLE_CORRECTION_HISTORY || abs(bestScore) >= MATE_THRESHOLD)
+        return;
+
+    // Deeper results are trusted more, each entry moves towards the error by weight / CORRECTION_HISTORY_WEIGHT_SCALE
+    int error = (bestScore - staticEval) * CORRECTION_HISTORY_GRAIN;
+    int weight = std::min(depth + 1, 16);
+    int side = board.whiteToMove;
+
+    auto update = [&](int16_t &entry) {
+        int value = (entry * (CORRECTION_HISTORY_WEIGHT_SCALE - weight) + (entry + error) * weight) /
+                    CORRECTION_HISTORY_WEIGHT_SCALE;
+        entry = static_cast<int16_t>(std::clamp(value, -CORRECTION_HISTORY_MAX, CORRECTION_HISTORY_MAX));
+    };
+    update(threadWorkerInfoPtr->pawnCorrectionHistory[side][pawnStructureKey(board) & (CORRECTION_HISTORY_SIZE - 1)]);
+    update(threadWorkerInfoPtr->materialCorrectionHistory[side][materialKey(board) & (CORRECTION_HISTORY_SIZE - 1)]);
+}
+
+int Search::cachedEvaluate(ThreadWorkerInfo *threadWorkerInfoPtr, Board &board) {
+    if (!ENABLE_EVAL_CACHE)
+        return evaluate(board);
+
+    EvalCacheEntry &entry = threadWorkerInfoPtr->evalCache[board.currentZobristKey & (EVAL_CACHE_SIZE - 1)];
+    auto keyCheck = static_cast<uint32_t>(board.currentZobristKey >> 32);
+    if (entry.keyCheck != keyCheck) {
+        entry.keyCheck = keyCheck;
+        entry.eval = evaluate(board);
+    }
+    return entry.eval;
 }
 
 int Search::evaluate(Board &board) {
@@ -373,6 +1099,77 @@ int Search::getPieceValue(uint8_t piece) {
     return PIECE_VALUES[piece];
 }
 
+/**
+ * Static exchange evaluation: plays out all captures on the target square, always with the least valuable attacker,
+ * and returns whether the side making the move comes out at least threshold centipawns ahead. X-ray attackers behind
+ * moved sliders are picked up as the occupancy shrinks.
+ */
+bool Search::staticExchangeEvaluation(Board &board, Move move, int threshold) {
+    if (move.castle || move.promotion != NONE)
+        return threshold <= 0;
+
+    int swap = (move.capture == NONE ? 0 : abs(getPieceValue(move.capture))) - threshold;
+    if (swap < 0)
+        return false;
+
+    swap = abs(getPieceValue(move.pieceFrom)) - swap;
+    if (swap <= 0)
+        return true;
+
+    uint64_t occupancy = board.BITBOARD_OCCUPANCY ^ 1ULL << move.from ^ 1ULL << move.to;
+    if (move.enPassantTarget != 0)
+        occupancy ^= 1ULL << move.enPassantTarget;
+
+    uint64_t attackers = Movegen::getAttackersToSquare(board, move.to, occupancy);
+    uint64_t diagonalSliders = board.BITBOARDS[WHITE_BISHOP] | board.BITBOARDS[BLACK_BISHOP] |
+                               board.BITBOARDS[WHITE_QUEEN] | board.BITBOARDS[BLACK_QUEEN];
+    uint64_t straightSliders = board.BITBOARDS[WHITE_ROOK] | board.BITBOARDS[BLACK_ROOK] |
+                               board.BITBOARDS[WHITE_QUEEN] | board.BITBOARDS[BLACK_QUEEN];
+
+    // Pieces are tried from least to most valuable
+    constexpr uint8_t CAPTURE_ORDER[6] = {WHITE_PAWN, WHITE_KNIGHT, WHITE_BISHOP, WHITE_ROOK, WHITE_QUEEN, WHITE_KING};
+
+    bool white = move.pieceFrom < 6;
+    int result = 1;
+    while (true) {
+        white = !white;
+        attackers &= occupancy;
+
+        uint64_t sideAttackers = attackers & (white ? board.BITBOARD_WHITE_OCCUPANCY : board.BITBOARD_BLACK_OCCUPANCY);
+        if (!sideAttackers)
+            break;
+
+        result ^= 1;
+
+        uint8_t attacker = NONE;
+        uint64_t attackerBitboard = 0ULL;
+        for (uint8_t piece: CAPTURE_ORDER) {
+            attackerBitboard = sideAttackers & board.BITBOARDS[white ? piece : piece + 6];
+            if (attackerBitboard) {
+                attacker = piece;
+                break;
+            }
+        }
+
+        if (attacker == WHITE_KING) {
+            // The king may only capture when the opponent has no attackers left
+            return attackers & ~sideAttackers ? result ^ 1 : result;
+        }
+
+        swap = abs(getPieceValue(attacker)) - swap;
+        if (swap < result)
+            break;
+
+        occupancy ^= attackerBitboard & -attackerBitboard;
+        if (attacker == WHITE_PAWN || attacker == WHITE_BISHOP || attacker == WHITE_QUEEN)
+            attackers |= Movegen::getBishopAttacks(move.to, occupancy) & diagonalSliders;
+        if (attacker == WHITE_ROOK || attacker == WHITE_QUEEN)
+            attackers |= Movegen::getRookAttacks(move.to, occupancy) & straightSliders;
+    }
+
+    return result;
+}
+
 bool Search::isNullMove(Move move) {
     return move.from == move.to;
 }
@@ -406,15 +1203,199 @@ int Search::evaluateKingDistance(uint8_t squareIndex, uint8_t otherKingIndex, ui
     return (std::abs(file1 - file2) + std::abs(rank1 - rank2)) * -50;
 }
 
-void Search::storeKillerMove(ThreadWorkerInfo *threadWorkerInfoPtr, Move move, int depth) {
+bool Search::setParameter(const std::string &name, int value) {
+    static const std::unordered_map<std::string, bool *> switches = {
+        {"reverse_futility_pruning", &ENABLE_REVERSE_FUTILITY_PRUNING},
+        {"razoring", &ENABLE_RAZORING},
+        {"futility_pruning", &ENABLE_FUTILITY_PRUNING},
+        {"late_move_pruning", &ENABLE_LATE_MOVE_PRUNING},
+        {"check_extensions", &ENABLE_CHECK_EXTENSIONS},
+        {"singular_extensions", &ENABLE_SINGULAR_EXTENSIONS},
+        {"internal_iterative_reduction", &ENABLE_INTERNAL_ITERATIVE_REDUCTION},
+        {"probcut", &ENABLE_PROBCUT},
+        {"delta_pruning", &ENABLE_DELTA_PRUNING},
+        {"quiescence_see_pruning", &ENABLE_QUIESCENCE_SEE_PRUNING},
+        {"correction_history", &ENABLE_CORRECTION_HISTORY},
+        {"eval_cache", &ENABLE_EVAL_CACHE},
+        {"null_move_pruning", &ENABLE_NULL_MOVE_PRUNING},
+        {"mtdf", &USE_MTDF},
+        {"pin_threads", &CpuTopology::pinThreads},
+        {"interleave_transposition_table", &CpuTopology::interleaveTranspositionTable},
+    };
+    static const std::unordered_map<std::string, int *> values = {
+        {"reverse_futility_max_depth", &REVERSE_FUTILITY_MAX_DEPTH},
+        {"reverse_futility_margin", &REVERSE_FUTILITY_MARGIN},
+        {"razoring_max_depth", &RAZORING_MAX_DEPTH},
+        {"razoring_margin", &RAZORING_MARGIN},
+        {"futility_max_depth", &FUTILITY_MAX_DEPTH},
+        {"futility_base", &FUTILITY_BASE},
+        {"futility_margin", &FUTILITY_MARGIN},
+        {"late_move_pruning_max_depth", &LATE_MOVE_PRUNING_MAX_DEPTH},
+        {"late_move_pruning_base", &LATE_MOVE_PRUNING_BASE},
+        {"singular_min_depth", &SINGULAR_MIN_DEPTH},
+        {"singular_tt_depth_margin", &SINGULAR_TT_DEPTH_MARGIN},
+        {"singular_margin", &SINGULAR_MARGIN},
+        {"internal_iterative_reduction_min_depth", &INTERNAL_ITERATIVE_REDUCTION_MIN_DEPTH},
+        {"probcut_min_depth", &PROBCUT_MIN_DEPTH},
+        {"probcut_depth_reduction", &PROBCUT_DEPTH_REDUCTION},
+        {"probcut_margin", &PROBCUT_MARGIN},
+        {"delta_margin", &DELTA_MARGIN},
+        {"null_move_min_depth", &NULL_MOVE_MIN_DEPTH},
+        {"null_move_base_reduction", &NULL_MOVE_BASE_REDUCTION},
+        {"null_move_depth_divisor", &NULL_MOVE_DEPTH_DIVISOR},
+        {"null_move_eval_divisor", &NULL_MOVE_EVAL_DIVISOR},
+        {"null_move_max_eval_reduction", &NULL_MOVE_MAX_EVAL_REDUCTION},
+        {"null_move_verification_depth", &NULL_MOVE_VERIFICATION_DEPTH},
+        {"move_overhead", &TimeManager::MOVE_OVERHEAD},
+        {"multipv", &MULTI_PV},
+    };
+
+    if (name == "hash") {
+        transpositionTable.resize(std::max(1, value));
+        return true;
+    }
+    if (name == "use_siblings") {
+        // Siblings change how many hardware threads there are to place search threads on
+        CpuTopology::useSiblings = value != 0;
+        CpuTopology::init();
+        MAX_THREADS = CpuTopology::recommendedThreadCount();
+        return true;
+    }
+    if (auto it = switches.find(name); it != switches.end()) {
+        *it->second = value != 0;
+        return true;
+    }
+    if (auto it = values.find(name); it != values.end()) {
+        *it->second = value;
+        return true;
+    }
+    return false;
+}
+
+void Search::printParameters() {
+    std::cout << "hash " << transpositionTable.sizeInMegabytes() << "\n"
+            << "reverse_futility_pruning " << ENABLE_REVERSE_FUTILITY_PRUNING << "\n"
+            << "reverse_futility_max_depth " << REVERSE_FUTILITY_MAX_DEPTH << "\n"
+            << "reverse_futility_margin " << REVERSE_FUTILITY_MARGIN << "\n"
+            << "razoring " << ENABLE_RAZORING << "\n"
+            << "razoring_max_depth " << RAZORING_MAX_DEPTH << "\n"
+            << "razoring_margin " << RAZORING_MARGIN << "\n"
+            << "futility_pruning " << ENABLE_FUTILITY_PRUNING << "\n"
+            << "futility_max_depth " << FUTILITY_MAX_DEPTH << "\n"
+            << "futility_base " << FUTILITY_BASE << "\n"
+            << "futility_margin " << FUTILITY_MARGIN << "\n"
+            << "late_move_pruning " << ENABLE_LATE_MOVE_PRUNING << "\n"
+            << "late_move_pruning_max_depth " << LATE_MOVE_PRUNING_MAX_DEPTH << "\n"
+            << "late_move_pruning_base " << LATE_MOVE_PRUNING_BASE << "\n"
+            << "check_extensions " << ENABLE_CHECK_EXTENSIONS << "\n"
+            << "singular_extensions " << ENABLE_SINGULAR_EXTENSIONS << "\n"
+            << "singular_min_depth " << SINGULAR_MIN_DEPTH << "\n"
+            << "singular_tt_depth_margin " << SINGULAR_TT_DEPTH_MARGIN << "\n"
+            << "singular_margin " << SINGULAR_MARGIN << "\n"
+            << "internal_iterative_reduction " << ENABLE_INTERNAL_ITERATIVE_REDUCTION << "\n"
+            << "internal_iterative_reduction_min_depth " << INTERNAL_ITERATIVE_REDUCTION_MIN_DEPTH << "\n"
+            << "probcut " << ENABLE_PROBCUT << "\n"
+            << "probcut_min_depth " << PROBCUT_MIN_DEPTH << "\n"
+            << "probcut_depth_reduction " << PROBCUT_DEPTH_REDUCTION << "\n"
+            << "probcut_margin " << PROBCUT_MARGIN << "\n"
+            << "delta_pruning " << ENABLE_DELTA_PRUNING << "\n"
+            << "delta_margin " << DELTA_MARGIN << "\n"
+            << "quiescence_see_pruning " << ENABLE_QUIESCENCE_SEE_PRUNING << "\n"
+            << "correction_history " << ENABLE_CORRECTION_HISTORY << "\n"
+            << "eval_cache " << ENABLE_EVAL_CACHE << "\n"
+            << "null_move_pruning " << ENABLE_NULL_MOVE_PRUNING << "\n"
+            << "null_move_min_depth " << NULL_MOVE_MIN_DEPTH << "\n"
+            << "null_move_base_reduction " << NULL_MOVE_BASE_REDUCTION << "\n"
+            << "null_move_depth_divisor " << NULL_MOVE_DEPTH_DIVISOR << "\n"
+            << "null_move_eval_divisor " << NULL_MOVE_EVAL_DIVISOR << "\n"
+            << "null_move_max_eval_reduction " << NULL_MOVE_MAX_EVAL_REDUCTION << "\n"
+            << "null_move_verification_depth " << NULL_MOVE_VERIFICATION_DEPTH << "\n"
+            << "move_overhead " << TimeManager::MOVE_OVERHEAD << "\n"
+            << "multipv " << MULTI_PV << "\n"
+            << "mtdf " << USE_MTDF << "\n"
+            << "pin_threads " << CpuTopology::pinThreads << "\n"
+            << "use_siblings " << CpuTopology::useSiblings << "\n"
+            << "interleave_transposition_table " << CpuTopology::interleaveTranspositionTable << std::endl;
+}
+
+void Search::storeKillerMove(ThreadWorkerInfo *threadWorkerInfoPtr, Move move, int rootDepth) {
     if (move.capture != NONE || move.promotion != NONE)
         return;
 
-    if (threadWorkerInfoPtr->killerMoves[depth][0] == move) return;
+    if (threadWorkerInfoPtr->killerMoves[rootDepth][0] == move) return;
 
     /*
      * the previous killer move is shifted is so that the first killer move in the array is always the most recent one, which is likely to be better in more positions
      */
-    threadWorkerInfoPtr->killerMoves[depth][1] = threadWorkerInfoPtr->killerMoves[depth][0];
-    threadWorkerInfoPtr->killerMoves[depth][0] = move;
+    threadWorkerInfoPtr->killerMoves[rootDepth][1] = threadWorkerInfoPtr->killerMoves[rootDepth][0];
+    threadWorkerInfoPtr->killerMoves[rootDepth][0] = move;
+}
+
+bool Search::isQuiet(Move move) {
+    return move.capture == NONE && move.promotion == NONE;
+}
+
+int Search::quietMoveScore(ThreadWorkerInfo *threadWorkerInfoPtr, Move move, int rootDepth) {
+    if (move == threadWorkerInfoPtr->killerMoves[rootDepth][0] || move == threadWorkerInfoPtr->killerMoves[rootDepth][1]) {
+        return KILLER_MOVE_BIAS;
+    }
+
+    int score = historyScore(threadWorkerInfoPtr, move, rootDepth);
+
+    if (rootDepth > 0) {
+        Move previous = threadWorkerInfoPtr->moveStack[rootDepth - 1];
+        if (previous.pieceFrom != NONE && move == threadWorkerInfoPtr->counterMoves[previous.pieceFrom][previous.to]) {
+            score += COUNTER_MOVE_BIAS;
+        }
+    }
+
+    return score;
+}
+
+int Search::historyScore(ThreadWorkerInfo *threadWorkerInfoPtr, Move move, int rootDepth) {
+    int score = threadWorkerInfoPtr->history[move.pieceFrom > 5][move.from][move.to];
+
+    for (int pliesBack = 1; pliesBack <= 2 && pliesBack <= rootDepth; pliesBack++) {
+        Move previous = threadWorkerInfoPtr->moveStack[rootDepth - pliesBack];
+        if (previous.pieceFrom == NONE)
+            break;
+
+        score += threadWorkerInfoPtr->continuationHistory[pliesBack - 1][previous.pieceFrom][previous.to][move.pieceFrom][move.to];
+    }
+
+    return score;
+}
+
+void Search::updateHistoryEntry(int16_t &entry, int bonus) {
+    // Gravity: the closer an entry is to HISTORY_MAX the less a bonus moves it, so old statistics decay
+    entry = static_cast<int16_t>(entry + bonus - entry * abs(bonus) / HISTORY_MAX);
+}
+
+void Search::updateQuietHistories(ThreadWorkerInfo *threadWorkerInfoPtr, Move bestMove, const Move *quietsSearched,
+                                  int quietCount, int rootDepth, int depth) {
+    int bonus = std::min(16 * depth * depth, HISTORY_BONUS_MAX);
+
+    auto updateMove = [&](Move move, int moveBonus) {
+        updateHistoryEntry(threadWorkerInfoPtr->history[move.pieceFrom > 5][move.from][move.to], moveBonus);
+
+        for (int pliesBack = 1; pliesBack <= 2 && pliesBack <= rootDepth; pliesBack++) {
+            Move previous = threadWorkerInfoPtr->moveStack[rootDepth - pliesBack];
+            if (previous.pieceFrom == NONE)
+                break;
+            updateHistoryEntry(threadWorkerInfoPtr->continuationHistory[pliesBack - 1][previous.pieceFrom][previous.to][move.pieceFrom][move.to], moveBonus);
+        }
+    };
+
+    updateMove(bestMove, bonus);
+
+    // The quiet moves searched before the cutoff move failed to produce one, so push them down
+    for (int i = 0; i < quietCount; i++) {
+        updateMove(quietsSearched[i], -bonus);
+    }
+
+    if (rootDepth > 0) {
+        Move previous = threadWorkerInfoPtr->moveStack[rootDepth - 1];
+        if (previous.pieceFrom != NONE)
+            threadWorkerInfoPtr->counterMoves[previous.pieceFrom][previous.to] = bestMove;
+    }
 }
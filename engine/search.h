@@ -1,12 +1,18 @@
 #pragma once
 
 #define MATE_THRESHOLD 30000
+#define MAX_PLY 256
 
+#include <atomic>
 #include <chrono>
 #include <limits>
+#include <mutex>
+#include <string>
 #include <thread>
+#include <vector>
 
 #include "board.h"
+#include "timemanager.h"
 #include "transpositiontable.h"
 #include "../util/arrayvec.h"
 
@@ -20,11 +26,99 @@ struct SearchResult {
     }
 };
 
+/**
+ * A legal move of the root position and what the search learned about it. score comes from the current iteration
+ * (the previous one until the move is searched again) and is NEGATIVE_INFINITY for moves that only proved to be
+ * worse than a line found before them. pv is the principal variation starting with the move itself.
+ */
+struct RootMove {
+    Move move;
+    int score = 0;
+    int previousScore = 0;
+    long nodes = 0;
+    std::vector<Move> pv;
+
+    explicit RootMove(Move m_move) : move(m_move), pv{m_move} {}
+};
+
+/**
+ * Static evaluation of a position, checked against the upper half of its Zobrist key.
+ */
+struct EvalCacheEntry {
+    uint32_t keyCheck = 0;
+    int32_t eval = 0;
+};
+
 struct ThreadWorkerInfo
 {
     int threadNumber;
     int depthToSearch;
-    Move killerMoves[256][2];
+    Move killerMoves[MAX_PLY][2];
+
+    /**
+     * The move played at every ply of the current line (NULL_MOVE after a null move), used to look up the
+     * countermove and continuation history of the moves that led to a node.
+     */
+    Move moveStack[MAX_PLY];
+    Move counterMoves[12][64];
+
+    /**
+     * Static evaluation of the node at every ply of the current line, NO_EVAL when the side to move was in check.
+     */
+    int staticEvals[MAX_PLY];
+
+    /**
+     * Move left out of the search at a ply while a singular extension verifies that the TT move is the only good one.
+     */
+    Move excludedMoves[MAX_PLY];
+
+    /**
+     * Null moves are not tried before this ply while a null move verification search is running.
+     */
+    int nullMoveMinPly = 0;
+
+    /**
+     * Quiet move ordering statistics, kept within +-HISTORY_MAX by gravity updates. history is the butterfly table
+     * indexed by side, from and to square. continuationHistory[0] is indexed by the piece and target square of the
+     * previous move followed by those of the current move, continuationHistory[1] does the same for the move two
+     * plies back.
+     */
+    int16_t history[2][64][64] = {};
+    int16_t continuationHistory[2][12][64][12][64] = {};
+
+    /**
+     * Static eval correction, indexed by side to move and a hash of the pawn structure or of the piece counts. Each
+     * entry tracks the average difference between search results and the static eval of positions sharing the key,
+     * in 1/CORRECTION_HISTORY_GRAIN centipawns.
+     */
+    int16_t pawnCorrectionHistory[2][16384] = {};
+    int16_t materialCorrectionHistory[2][16384] = {};
+
+    /**
+     * Uncorrected static evals of recently evaluated positions, indexed by the low bits of the Zobrist key. Kept per
+     * thread so it needs no validation against concurrent writes.
+     */
+    EvalCacheEntry evalCache[65536] = {};
+
+    /**
+     * Nodes searched by this thread. Kept per thread so the hot path never writes to a cache line shared with other
+     * threads.
+     */
+    long nodes = 0;
+
+    /**
+     * The root moves in the order of the last search, best first. With MultiPV the lines before pvIndex are already
+     * settled for the current iteration and the root only searches the moves from pvIndex on.
+     */
+    std::vector<RootMove> rootMoves;
+    int pvIndex = 0;
+
+    /**
+     * Triangular principal variation table: pvTable[ply] holds the best line found from ply, in
+     * pvTable[ply][ply] to pvTable[ply][pvLength[ply] - 1].
+     */
+    Move pvTable[MAX_PLY + 1][MAX_PLY + 1];
+    int pvLength[MAX_PLY + 1];
 
     Board board;
 
@@ -32,7 +126,10 @@ struct ThreadWorkerInfo
 };
 
 namespace Search {
-    static int MAX_THREADS = std::thread::hardware_concurrency() / 2;
+    /**
+     * Defaults to one search thread per physical core, filled in from CpuTopology at startup.
+     */
+    inline int MAX_THREADS = 1;
 
     inline constexpr Move NULL_MOVE = Move();
 
@@ -202,10 +299,146 @@ namespace Search {
     inline constexpr int LOSING_CAPTURE_BIAS = 2000000;
     inline constexpr int WINNING_CAPTURE_BIAS = 8000000;
     inline constexpr int PROMOTE_BIAS = 6000000;
+    inline constexpr int COUNTER_MOVE_BIAS = 1000000;
+
+    inline constexpr int HISTORY_MAX = 16384;
+    inline constexpr int HISTORY_BONUS_MAX = 1536;
+
+    inline constexpr int NO_EVAL = std::numeric_limits<int>::min();
+
+    /**
+     * Correction history: the static eval used for pruning is shifted by the average of the learned errors of its
+     * pawn structure and its material configuration, at most CORRECTION_HISTORY_MAX / CORRECTION_HISTORY_GRAIN
+     * centipawns.
+     */
+    inline bool ENABLE_CORRECTION_HISTORY = true;
+    inline constexpr int CORRECTION_HISTORY_SIZE = 16384;
+    inline constexpr int CORRECTION_HISTORY_GRAIN = 256;
+    inline constexpr int CORRECTION_HISTORY_MAX = 64 * CORRECTION_HISTORY_GRAIN;
+    inline constexpr int CORRECTION_HISTORY_WEIGHT_SCALE = 256;
+
+    /**
+     * Eval cache: positions reached again through transpositions, re-searches or quiescence are not evaluated twice,
+     * EVAL_CACHE_SIZE entries of 8 bytes (512 KB) per thread. Unlike the static eval stored in the TT, it also holds
+     * positions whose TT entry was replaced or never written, like quiescence nodes that stand pat.
+     */
+    inline bool ENABLE_EVAL_CACHE = true;
+    inline constexpr int EVAL_CACHE_SIZE = 65536;
+
+    /**
+     * Late move reductions: quiet moves searched after the first LMR_MIN_MOVES are reduced by
+     * LMR_BASE + ln(depth) * ln(moveNumber) / LMR_DIVISOR plies, one ply more when the position is not improving,
+     * one ply less at PV nodes and a ply per LMR_HISTORY_DIVISOR points of history in either direction.
+     */
+    inline constexpr int LMR_MIN_DEPTH = 3;
+    inline constexpr int LMR_MIN_MOVES = 2;
+    inline constexpr double LMR_BASE = 0.75;
+    inline constexpr double LMR_DIVISOR = 2.25;
+    inline constexpr int LMR_HISTORY_DIVISOR = 8192;
+
+    inline int LATE_MOVE_REDUCTIONS[64][64];
+
+    /**
+     * Forward pruning near the leaves. Every technique can be switched off and its margins changed at runtime
+     * (see setParameter) so that variants can be compared against each other.
+     *
+     * Reverse futility: a non-PV node whose static eval beats beta by REVERSE_FUTILITY_MARGIN per ply of depth is
+     * cut without searching.
+     * Razoring: a node whose static eval is RAZORING_MARGIN per ply below alpha drops straight into quiescence.
+     * Futility: quiet moves are skipped when the static eval plus FUTILITY_BASE + FUTILITY_MARGIN per ply cannot
+     * reach alpha.
+     * Late move pruning: quiet moves are skipped once (LATE_MOVE_PRUNING_BASE + depth^2) of them were searched,
+     * half as many when the position is not improving.
+     */
+    inline bool ENABLE_REVERSE_FUTILITY_PRUNING = true;
+    inline int REVERSE_FUTILITY_MAX_DEPTH = 6;
+    inline int REVERSE_FUTILITY_MARGIN = 80;
+
+    inline bool ENABLE_RAZORING = true;
+    inline int RAZORING_MAX_DEPTH = 3;
+    inline int RAZORING_MARGIN = 250;
+
+    inline bool ENABLE_FUTILITY_PRUNING = true;
+    inline int FUTILITY_MAX_DEPTH = 6;
+    inline int FUTILITY_BASE = 100;
+    inline int FUTILITY_MARGIN = 90;
+
+    /**
+     * Extensions: moves that give check are searched one ply deeper. The TT move is extended as well when a search
+     * at half depth without it fails low against the TT score minus SINGULAR_MARGIN per ply. If that search fails
+     * high against beta instead, several moves beat beta and the node is cut (multi-cut). Extensions stop once a
+     * line is twice as long as the iteration depth.
+     */
+    inline bool ENABLE_CHECK_EXTENSIONS = true;
+
+    inline bool ENABLE_SINGULAR_EXTENSIONS = true;
+    inline int SINGULAR_MIN_DEPTH = 7;
+    inline int SINGULAR_TT_DEPTH_MARGIN = 3;
+    inline int SINGULAR_MARGIN = 2;
+
+    /**
+     * Internal iterative reduction: PV and cut nodes without a TT move are searched one ply shallower, the next
+     * iteration then finds a hash move stored by this cheaper search.
+     */
+    inline bool ENABLE_INTERNAL_ITERATIVE_REDUCTION = true;
+    inline int INTERNAL_ITERATIVE_REDUCTION_MIN_DEPTH = 4;
+
+    /**
+     * ProbCut: at non-PV nodes of at least PROBCUT_MIN_DEPTH, captures that win at least PROBCUT_MARGIN over beta by
+     * static exchange are searched PROBCUT_DEPTH_REDUCTION plies shallower against beta + PROBCUT_MARGIN. If one of
+     * them holds, the full depth search would almost certainly fail high as well and the node is cut.
+     */
+    inline bool ENABLE_PROBCUT = true;
+    inline int PROBCUT_MIN_DEPTH = 5;
+    inline int PROBCUT_DEPTH_REDUCTION = 4;
+    inline int PROBCUT_MARGIN = 200;
+
+    /**
+     * Null move pruning: when the static eval is at least beta, the side to move passes and a search reduced by
+     * NULL_MOVE_BASE_REDUCTION + depth / NULL_MOVE_DEPTH_DIVISOR plies, plus a ply per NULL_MOVE_EVAL_DIVISOR of eval
+     * above beta (at most NULL_MOVE_MAX_EVAL_REDUCTION), has to fail high. From NULL_MOVE_VERIFICATION_DEPTH on the
+     * cutoff is verified by a reduced search without null moves, which catches zugzwang.
+     */
+    inline bool ENABLE_NULL_MOVE_PRUNING = true;
+    inline int NULL_MOVE_MIN_DEPTH = 3;
+    inline int NULL_MOVE_BASE_REDUCTION = 2;
+    inline int NULL_MOVE_DEPTH_DIVISOR = 4;
+    inline int NULL_MOVE_EVAL_DIVISOR = 200;
+    inline int NULL_MOVE_MAX_EVAL_REDUCTION = 3;
+    inline int NULL_MOVE_VERIFICATION_DEPTH = 10;
+
+    /**
+     * Quiescence pruning: captures that cannot raise the standing pat to alpha even when the captured piece is won
+     * outright plus DELTA_MARGIN are skipped (delta pruning), as are captures that lose material by static exchange.
+     * Neither applies while in check, where all evasions are searched.
+     */
+    inline bool ENABLE_DELTA_PRUNING = true;
+    inline int DELTA_MARGIN = 200;
+
+    inline bool ENABLE_QUIESCENCE_SEE_PRUNING = true;
+
+    inline bool ENABLE_LATE_MOVE_PRUNING = true;
+    inline int LATE_MOVE_PRUNING_MAX_DEPTH = 6;
+    inline int LATE_MOVE_PRUNING_BASE = 3;
+
+    /**
+     * Aspiration windows: from ASPIRATION_MIN_DEPTH on, each iteration starts with a window of ASPIRATION_WINDOW
+     * centipawns around the previous score. Helper threads widen their starting window a little per thread so that
+     * they do not all fail on the same bound, and the window doubles on every fail-high/fail-low until it is wider
+     * than ASPIRATION_MAX_WINDOW, after which the full window is used.
+     */
+    inline constexpr int ASPIRATION_MIN_DEPTH = 4;
+    inline constexpr int ASPIRATION_WINDOW = 25;
+    inline constexpr int ASPIRATION_HELPER_OFFSET = 6;
+    inline constexpr int ASPIRATION_MAX_WINDOW = 1000;
+
+    /**
+     * Runs every iteration as MTD(f) instead of an aspiration window: a series of zero window searches, starting from
+     * the score of the previous iteration, that converges on the exact score through the TT.
+     */
+    inline bool USE_MTDF = false;
 
 
-    inline long currentTimeMillis = 0;
-    inline long searchDuration = 0;
     inline int currentEval = 0;
     inline long times[256] = {};
     inline float evaluations[1024] = {};
@@ -217,30 +450,139 @@ namespace Search {
     inline double nodesPerSecond;
     inline long nullPrunes = 0;
 
-    inline TranspositionTable transpositionTable = TranspositionTable();
+    /**
+     * Number of best lines searched and reported, each one with its own score and principal variation.
+     */
+    inline int MULTI_PV = 1;
+
+    /**
+     * The first MULTI_PV root moves of the last completed iteration of the main thread, guarded by
+     * principalVariationsMutex since the GUI reads them while the search is running.
+     */
+    inline std::vector<RootMove> principalVariations;
+    inline std::mutex principalVariationsMutex;
+
+    /**
+     * Root key and best line of the last search, and the key of the position its first move leads to. An infinite
+     * search started on that root again or on a child of it resumes at the depth the TT already holds for the new
+     * root instead of climbing from depth 1.
+     */
+    inline uint64_t lastRootKey = 0;
+    inline uint64_t lastPrincipalVariationChildKey = 0;
+    inline std::vector<Move> lastPrincipalVariation;
+
+    inline TranspositionTable transpositionTable;
 
     volatile inline bool searchCancelled = false;
 
     inline Move bestMove = NULL_MOVE;
 
-    void orderMoves(ArrayVec<Move, 218> &moveVector, int rootDepth, ThreadWorkerInfo *threadWorkerInfoPtr, Move ttMove, int depth);
+    void orderMoves(ArrayVec<Move, 218> &moveVector, int rootDepth, ThreadWorkerInfo *threadWorkerInfoPtr, Move ttMove);
 
+    /**
+     * Searches for a fixed number of milliseconds.
+     */
     void startIterativeSearch(Board& board, long time);
 
+    /**
+     * searchMoves restricts the root to the given moves, all legal moves are searched when it is empty. An infinite
+     * time control runs until searchCancelled is set and continues the previous analysis where possible.
+     */
+    void startIterativeSearch(Board& board, const TimeControl &timeControl, const std::vector<Move> &searchMoves = {});
+
+    /**
+     * Cancels the search until the thread running it clears running. A cancel that lands before the search started
+     * gets reset by it, so a single one is not enough.
+     */
+    void cancelAndWait(const std::atomic<bool> &running);
+
+    std::vector<RootMove> generateRootMoves(Board& board, const std::vector<Move> &searchMoves);
+
+    /**
+     * Depth to start iterating at for a search continuing the last one, 1 otherwise. When the root lies on the last
+     * principal variation, the rest of that line is put first as the expected best move, PV and score, and
+     * expectedLineFound is set.
+     */
+    int continuationDepth(Board& board, std::vector<RootMove> &rootMoves, bool &expectedLineFound);
+
+    /**
+     * Saves the transposition table along with the root of the last search, and loads it back. After a load an
+     * infinite search on that root, or on a child of it, continues at the depth the table holds for it.
+     */
+    bool saveTranspositionTable(const std::string &path);
+    bool loadTranspositionTable(const std::string &path);
+
+    void sortRootMoves(ThreadWorkerInfo *threadWorkerInfoPtr, int first, int last);
+
+    void diversifyRootMoves(ArrayVec<Move, 218> &moveVector, ThreadWorkerInfo *threadWorkerInfoPtr);
+
+    void updatePrincipalVariation(ThreadWorkerInfo *threadWorkerInfoPtr, Move move, int rootDepth);
+
+    std::vector<RootMove> getPrincipalVariations();
+
+    /**
+     * The reply expected after the best move, the second move of the main line. NULL_MOVE when the line ends early.
+     */
+    Move getPonderMove();
+
+    std::string principalVariationToSan(Board board, const std::vector<Move> &pv);
+
     void threadSearch(ThreadWorkerInfo *info);
 
-    SearchResult search(Board& board, ThreadWorkerInfo *threadWorkerInfoPtr, int rootDepth, int depth, int alpha, int beta, bool wasNullSearch, bool inPrincipalVariation);
+    /**
+     * cutNode marks a non-PV node that is expected to fail high, the children of a cut node are expected to be all
+     * nodes and the other way around. PV nodes are the ones searched with an open window (beta - alpha > 1).
+     * inPrincipalVariation marks the nodes on the line of first moves from the root and the full window re-searches
+     * of moves that beat alpha. They take no TT cutoffs, so the PV table always gets the complete line.
+     */
+    SearchResult search(Board& board, ThreadWorkerInfo *threadWorkerInfoPtr, int rootDepth, int depth, int alpha, int beta, bool wasNullSearch, bool inPrincipalVariation, bool cutNode);
 
     SearchResult search(Board& board, ThreadWorkerInfo *threadWorkerInfoPtr, int depth);
 
-    int negatedPrincipalVariationSearch(Board& board, ThreadWorkerInfo *threadWorkerInfoPtr, Move move, bool &firstMove, int moved, int rootDepth, int depth, int alpha, int beta, bool wasNullSearch, bool inPrincipalVariation);
+    SearchResult search(Board& board, ThreadWorkerInfo *threadWorkerInfoPtr, int depth, int alpha, int beta);
+
+    SearchResult aspirationSearch(Board& board, ThreadWorkerInfo *threadWorkerInfoPtr, int depth, int previousScore);
+
+    SearchResult mtdfSearch(Board& board, ThreadWorkerInfo *threadWorkerInfoPtr, int depth, int firstGuess);
+
+    /**
+     * Follows the TT moves from the position after firstMove, zero window searches leave no PV behind otherwise.
+     */
+    std::vector<Move> principalVariationFromTable(Board board, Move firstMove, int maxLength);
+
+    int negatedPrincipalVariationSearch(Board& board, ThreadWorkerInfo *threadWorkerInfoPtr, bool &firstMove, int rootDepth, int depth, int alpha, int beta, bool wasNullSearch, bool inPrincipalVariation, bool cutNode, int reduction);
+
+    void initializeLateMoveReductionTable();
+
+    int lateMoveReduction(ThreadWorkerInfo *threadWorkerInfoPtr, Move move, int moved, int rootDepth, int depth, bool pvNode, bool cutNode, bool improving);
 
     int evaluate(Board& board);
 
-    int quiesce(Board& board, int alpha, int beta);
+    /**
+     * evaluate through the eval cache of the thread.
+     */
+    int cachedEvaluate(ThreadWorkerInfo *threadWorkerInfoPtr, Board& board);
+
+    uint64_t pawnStructureKey(Board& board);
+
+    uint64_t materialKey(Board& board);
+
+    int correctStaticEval(ThreadWorkerInfo *threadWorkerInfoPtr, Board& board, int rawEval);
+
+    void updateCorrectionHistory(ThreadWorkerInfo *threadWorkerInfoPtr, Board& board, int depth, int bestScore, int staticEval);
+
+    /**
+     * Counts a node for the thread and checks the clock every NODE_CHECK_INTERVAL nodes, true once the search is
+     * cancelled.
+     */
+    bool countNode(ThreadWorkerInfo *threadWorkerInfoPtr);
+
+    int quiesce(Board& board, ThreadWorkerInfo *threadWorkerInfoPtr, int rootDepth, int alpha, int beta);
 
     int getPieceValue(uint8_t piece);
 
+    bool staticExchangeEvaluation(Board& board, Move move, int threshold);
+
     double getEndGameBias(Board& board);
 
     bool canNullMove(Board& board);
@@ -251,13 +593,20 @@ namespace Search {
 
     int evaluateKingDistance(uint8_t squareIndex, uint8_t otherKingIndex, uint8_t piece, int materialDelta);
 
-    void storeKillerMove(ThreadWorkerInfo *threadWorkerInfoPtr, Move move, int depth);
+    bool setParameter(const std::string &name, int value);
 
-    inline long getMillisSinceEpoch()
-    {
-        const auto now     = std::chrono::system_clock::now();
-        const auto epoch   = now.time_since_epoch();
-        const auto seconds = std::chrono::duration_cast<std::chrono::milliseconds>(epoch);
-        return seconds.count();
-    }
+    void printParameters();
+
+    void storeKillerMove(ThreadWorkerInfo *threadWorkerInfoPtr, Move move, int rootDepth);
+
+    bool isQuiet(Move move);
+
+    int quietMoveScore(ThreadWorkerInfo *threadWorkerInfoPtr, Move move, int rootDepth);
+
+    int historyScore(ThreadWorkerInfo *threadWorkerInfoPtr, Move move, int rootDepth);
+
+    void updateHistoryEntry(int16_t &entry, int bonus);
+
+    void updateQuietHistories(ThreadWorkerInfo *threadWorkerInfoPtr, Move bestMove, const Move *quietsSearched,
+                              int quietCount, int rootDepth, int depth);
 }
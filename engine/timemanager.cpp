@@ -0,0 +1,72 @@
+#include "timemanager.h"
+
+#include <algorithm>
+#include <limits>
+
+static bool fixedTime = false;
+
+void TimeManager::start(const TimeControl &timeControl) {
+    startTime = std::chrono::steady_clock::now();
+    bestMoveStability = 0;
+    previousScore = 0;
+    ponderHitTime = 0;
+    pondering = timeControl.ponder;
+    fixedTime = timeControl.infinite || timeControl.moveTime >= 0 || timeControl.remaining < 0;
+
+    if (timeControl.infinite || (timeControl.moveTime < 0 && timeControl.remaining < 0)) {
+        softLimit = hardLimit = std::numeric_limits<long>::max();
+        return;
+    }
+
+    if (timeControl.moveTime >= 0) {
+        softLimit = hardLimit = timeControl.moveTime;
+        return;
+    }
+
+    // Spread the clock plus the increments still to come over the remaining moves, paying the overhead on each
+    int movesToGo = timeControl.movesToGo > 0 ? std::min(timeControl.movesToGo, DEFAULT_MOVES_TO_GO)
+                                              : DEFAULT_MOVES_TO_GO;
+    long available = std::max(1L, timeControl.remaining + timeControl.increment * (movesToGo - 1) -
+                                  static_cast<long>(MOVE_OVERHEAD) * movesToGo);
+
+    long target = available / movesToGo;
+    long maximum = static_cast<long>(timeControl.remaining * HARD_LIMIT_FRACTION) - MOVE_OVERHEAD;
+
+    hardLimit = std::max(1L, std::min(static_cast<long>(target * HARD_LIMIT_MULTIPLIER), maximum));
+    softLimit = std::max(1L, std::min(target, hardLimit));
+}
+
+long TimeManager::elapsed() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+bool TimeManager::hardLimitReached() {
+    return !pondering && elapsed() - ponderHitTime >= hardLimit;
+}
+
+void TimeManager::ponderHit() {
+    ponderHitTime = elapsed();
+    pondering = false;
+}
+
+bool TimeManager::shouldStopIteration(int depth, bool bestMoveChanged, int score, double bestMoveNodes) {
+    bestMoveStability = bestMoveChanged ? 0 : std::min(bestMoveStability + 1, 10);
+    int scoreDrop = depth > 1 ? previousScore - score : 0;
+    previousScore = score;
+
+    // A fixed move time is always used up, the hard limit ends the search
+    if (fixedTime || pondering)
+        return false;
+
+    // A best move that keeps changing needs more time, one that held for many iterations needs less
+    double stabilityScale = std::max(0.6, 1.3 - 0.1 * bestMoveStability);
+
+    // Spend more when the score is falling, the position is probably worse than it looked
+    double scoreScale = std::clamp(1.0 + scoreDrop / 200.0, 0.9, 1.5);
+
+    // Most of the effort going into the best move means the alternatives were refuted quickly
+    double nodeScale = std::clamp(1.5 - bestMoveNodes, 0.6, 1.4);
+
+    double scaledLimit = static_cast<double>(softLimit) * stabilityScale * scoreScale * nodeScale;
+    return elapsed() >= std::min(scaledLimit, static_cast<double>(hardLimit));
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+
+/**
+ * The clock situation a search is started with, all times in milliseconds. A non-negative moveTime searches for
+ * exactly that long, otherwise the budget is derived from the remaining time of the side to move, its increment and
+ * the number of moves left until the next time control (0 when the whole game has to be played on this clock).
+ * A ponder search runs on the opponent's time until ponderHit converts it into a search with these limits.
+ */
+struct TimeControl {
+    long remaining = -1;
+    long increment = 0;
+    int movesToGo = 0;
+    long moveTime = -1;
+    bool infinite = false;
+    bool ponder = false;
+};
+
+namespace TimeManager {
+    /**
+     * Time kept back on every move for the GUI and operating system, so lag between moves does not flag the engine.
+     */
+    inline int MOVE_OVERHEAD = 30;
+
+    /**
+     * Games without moves to go are budgeted as if DEFAULT_MOVES_TO_GO moves were left. The hard limit may use at
+     * most HARD_LIMIT_MULTIPLIER times the soft target and never more than HARD_LIMIT_FRACTION of the clock.
+     */
+    inline constexpr int DEFAULT_MOVES_TO_GO = 40;
+    inline constexpr double HARD_LIMIT_MULTIPLIER = 5.0;
+    inline constexpr double HARD_LIMIT_FRACTION = 0.75;
+
+    /**
+     * Checking the clock every NODE_CHECK_INTERVAL nodes of a single thread keeps the overhead negligible while
+     * still stopping within a fraction of a millisecond of the hard limit.
+     */
+    inline constexpr long NODE_CHECK_INTERVAL = 1024;
+
+    inline std::chrono::steady_clock::time_point startTime;
+
+    /**
+     * No new iteration is started once the scaled soft limit has passed, the search is aborted at the hard limit.
+     */
+    inline long softLimit = 0;
+    inline long hardLimit = 0;
+
+    /**
+     * Consecutive completed iterations that returned the same best move, and the score of the previous iteration.
+     */
+    inline int bestMoveStability = 0;
+    inline int previousScore = 0;
+
+    /**
+     * Set while the search is pondering on the expected reply, neither limit stops it until ponderHit. The hard limit
+     * is then measured from ponderHitTime (milliseconds after the start) since only that part runs on our clock,
+     * while the soft limit keeps counting from the start so the work done during pondering shortens the search.
+     */
+    inline std::atomic<bool> pondering = false;
+    inline std::atomic<long> ponderHitTime = 0;
+
+    void start(const TimeControl &timeControl);
+
+    long elapsed();
+
+    bool hardLimitReached();
+
+    void ponderHit();
+
+    /**
+     * Called by the main thread after every completed iteration. bestMoveNodes is the fraction of the nodes searched
+     * so far that were spent below the best root move.
+     */
+    bool shouldStopIteration(int depth, bool bestMoveChanged, int score, double bestMoveNodes);
+}
@@ -1,16 +1,203 @@
 #include "transpositiontable.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
 #include <cstring>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "cputopology.h"
+#include "movegen.h"
 #include "search.h"
+#include "zobrist.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/**
+ * Asks for transparent huge pages on a HUGE_PAGE_SIZE aligned range. Only a hint, the table works the same with
+ * regular pages, so a refusal is reported but not an error.
+ */
+static void adviseHugePages([[maybe_unused]] void *memory, [[maybe_unused]] size_t bytes) {
+#ifdef __linux__
+    if (madvise(memory, bytes, MADV_HUGEPAGE) != 0)
+        std::cerr << "Warning: no transparent huge pages for the transposition table (" << std::strerror(errno) <<
+                ")" << std::endl;
+#endif
+}
+
+static void *allocateAligned(size_t bytes) {
+#ifdef _WIN32
+    return _aligned_malloc(bytes, TranspositionTable::HUGE_PAGE_SIZE);
+#else
+    void *memory = std::aligned_alloc(TranspositionTable::HUGE_PAGE_SIZE, bytes);
+    if (memory != nullptr)
+        adviseHugePages(memory, bytes);
+    return memory;
+#endif
+}
+
+static void freeAligned(void *memory) {
+#ifdef _WIN32
+    _aligned_free(memory);
+#else
+    std::free(memory);
+#endif
+}
+
+/**
+ * Header of a shared table, alone in the first HUGE_PAGE_SIZE of the segment so that the clusters after it start on a
+ * huge page boundary. magic is written last by the process that creates the segment, the others wait for it before
+ * trusting the rest.
+ */
+struct SharedTableHeader {
+    static constexpr uint32_t MAGIC = 0x53545443;
+    static constexpr uint32_t FORMAT_VERSION = 2;
+    static constexpr size_t SLOT_SIZE = TranspositionTable::HUGE_PAGE_SIZE;
+
+    std::atomic<uint32_t> magic;
+    uint32_t formatVersion;
+    uint64_t clusters;
+    uint64_t keyFingerprint;
+    std::atomic<uint32_t> generation;
+    std::atomic<int32_t> processes;
+    uint8_t reserved[32];
+};
+
+static_assert(sizeof(SharedTableHeader) == 64);
+static_assert(std::atomic<uint32_t>::is_always_lock_free);
+
+#ifndef _WIN32
+/**
+ * Maps a shared segment at a HUGE_PAGE_SIZE boundary, mmap alone only guarantees regular page alignment.
+ */
+static void *mapHugePageAligned(int descriptor, size_t bytes) {
+    size_t alignment = TranspositionTable::HUGE_PAGE_SIZE;
+    void *reservation = mmap(nullptr, bytes + alignment, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (reservation == MAP_FAILED)
+        return MAP_FAILED;
+
+    auto start = reinterpret_cast<uintptr_t>(reservation);
+    uintptr_t aligned = (start + alignment - 1) / alignment * alignment;
+    if (aligned > start)
+        munmap(reservation, aligned - start);
+    munmap(reinterpret_cast<void *>(aligned + bytes), start + alignment - aligned);
+
+    void *mapping = mmap(reinterpret_cast<void *>(aligned), bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+                         descriptor, 0);
+    if (mapping == MAP_FAILED)
+        munmap(reinterpret_cast<void *>(aligned), bytes);
+    return mapping;
+}
+#endif
+
+static uint64_t keyFingerprint() {
+    uint64_t fingerprint = 0;
+    for (uint64_t key: Zobrist::randoms)
+        fingerprint = std::rotl(fingerprint, 7) ^ key;
+    return fingerprint;
+}
+
+static size_t clustersFor(size_t megabytes) {
+    size_t clusters = 1;
+    while (clusters * 2 * sizeof(TranspositionCluster) <= std::max<size_t>(megabytes, 1) * 1024 * 1024)
+        clusters *= 2;
+    return clusters;
+}
+
+TranspositionTable::~TranspositionTable() {
+    release();
+}
+
+void TranspositionTable::newSearch() {
+    // Processes sharing the table count searches together, their entries would look arbitrarily old to each other
+    // with a generation each
+    generation = ((sharedHeader != nullptr ? sharedHeader->generation++ : generation) + 1) &
+                 TranspositionEntry::GENERATION_MASK;
+}
 
 void TranspositionTable::addEntry(uint64_t zobristKey, Move bestMove, int rootDepth, int depthSearched, int score,
-                                  int nodeType) {
-    uint64_t index = zobristKey & TRANSPOSITION_TABLE_MASK;
+                                  int nodeType, int staticEval) {
+    TranspositionEntry *entries = transpositionTableBuffer[zobristKey & transpositionTableMask].entries;
 
+    uint16_t moveBits = encodeMove(bestMove);
+    TranspositionEntry *replace = nullptr;
+    int lowestWorth = 0;
+    for (int i = 0; i < TranspositionCluster::CLUSTER_SIZE; i++) {
+        TranspositionEntry &entry = entries[i];
+        // Clusters fill up front to back, an empty entry means the key is not stored further on either
+        if (entry.empty()) {
+            replace = &entry;
+            tableEntries++;
+            break;
+        }
 
-    transpositionTableBuffer[index] = TranspositionEntry(zobristKey, bestMove, depthSearched,
-                                                         correctScoreForStorage(score, rootDepth), nodeType);
-    if (tableEntries < TRANSPOSITION_TABLE_SIZE)
-        tableEntries++;
+        if (entry.matches(zobristKey)) {
+            // Keep a much deeper bound of this search, and the best move when the new result has none
+            if (nodeType != EXACT_BOUND && entry.generation() == generation && entry.depthSearched > depthSearched + 4)
+                return;
+            if (moveBits == 0)
+                moveBits = entry.moveBits;
+            replace = &entry;
+            break;
+        }
+
+        int age = (generation - entry.generation()) & TranspositionEntry::GENERATION_MASK;
+        int worth = entry.depthSearched - REPLACEMENT_AGE_WEIGHT * age;
+        if (replace == nullptr || worth < lowestWorth) {
+            replace = &entry;
+            lowestWorth = worth;
+        }
+    }
+
+    *replace = TranspositionEntry(zobristKey, moveBits, depthSearched, correctScoreForStorage(score, rootDepth),
+                                  staticEval == Search::NO_EVAL ? TranspositionEntry::NO_STATIC_EVAL : staticEval, nodeType,
+                                  generation);
+}
+
+uint16_t TranspositionTable::encodeMove(Move move) {
+    uint16_t bits = move.from | move.to << 6;
+    for (int i = 0; i < 4; i++) {
+        if (move.promotion != NONE && (move.promotion == Movegen::PROMOTE_PIECES_WHITE[i] ||
+                                       move.promotion == Movegen::PROMOTE_PIECES_BLACK[i]))
+            bits |= (i | 0b100) << 12;
+    }
+    return bits;
+}
+
+Move TranspositionTable::decodeMove(const Board &board, uint16_t moveBits) {
+    Move move(moveBits & 0x3F, (moveBits >> 6) & 0x3F);
+    move.pieceFrom = board.getPiece(move.from);
+    if (move.from == move.to || move.pieceFrom == NONE || (move.pieceFrom < BLACK_PAWN) != board.whiteToMove)
+        return Search::NULL_MOVE;
+
+    move.capture = board.getPiece(move.to);
+    if (move.capture != NONE && (move.capture < BLACK_PAWN) == board.whiteToMove)
+        return Search::NULL_MOVE;
+
+    bool pawn = move.pieceFrom == WHITE_PAWN || move.pieceFrom == BLACK_PAWN;
+    bool king = move.pieceFrom == WHITE_KING || move.pieceFrom == BLACK_KING;
+    if (moveBits >> 14 & 1) {
+        if (!pawn)
+            return Search::NULL_MOVE;
+        int piece = (moveBits >> 12) & 0b11;
+        move.promotion = board.whiteToMove ? Movegen::PROMOTE_PIECES_WHITE[piece] : Movegen::PROMOTE_PIECES_BLACK[piece];
+    } else if (king && std::abs(move.to - move.from) == 2) {
+        move.castle = true;
+    } else if (pawn && move.capture == NONE && (move.to - move.from) % 8 != 0) {
+        move.capture = board.whiteToMove ? BLACK_PAWN : WHITE_PAWN;
+        move.enPassantTarget = board.whiteToMove ? move.to - 8 : move.to + 8;
+    }
+    return move;
 }
 
 int TranspositionTable::correctScoreForRetrieval(int score, int rootDepth) {
@@ -34,23 +221,325 @@ int TranspositionTable::correctScoreForStorage(int score, int rootDepth) {
 }
 
 int TranspositionTable::tableLookup(uint64_t zobristKey, TranspositionEntry &out) {
-    uint64_t index = zobristKey & TRANSPOSITION_TABLE_MASK;
-    TranspositionEntry entry = transpositionTableBuffer[index];
+    TranspositionEntry *entries = transpositionTableBuffer[zobristKey & transpositionTableMask].entries;
 
-    if (entry.zobristKey == 0) {
-        return TRANSPOSITION_TABLE_LOOKUP_FAILURE;
-    }
+    for (int i = 0; i < TranspositionCluster::CLUSTER_SIZE; i++) {
+        TranspositionEntry entry = entries[i];
+        if (entry.empty())
+            break;
 
-    if (entry.zobristKey == (zobristKey ^ entry.data)) {
-        out = entry;
-        return TRANSPOSITION_TABLE_LOOKUP_SUCCESS;
+        if (entry.matches(zobristKey)) {
+            // A hit keeps an entry of an earlier search from aging out
+            if (entry.generation() != generation) {
+                entry = TranspositionEntry(zobristKey, entry.moveBits, entry.depthSearched, entry.score,
+                                           entry.staticEval, entry.nodeType(), generation);
+                entries[i] = entry;
+            }
+            out = entry;
+            return TRANSPOSITION_TABLE_LOOKUP_SUCCESS;
+        }
     }
 
     return TRANSPOSITION_TABLE_LOOKUP_FAILURE;
 }
 
 
+void TranspositionTable::resize(size_t megabytes) {
+    allocate(clustersFor(megabytes));
+}
+
+void TranspositionTable::allocateIfNeeded() {
+    if (transpositionTableBuffer == nullptr)
+        resize(DEFAULT_SIZE_MB);
+}
+
+void TranspositionTable::allocate(size_t clusters) {
+    // aligned_alloc needs a multiple of the alignment, tables below one huge page get the rest of it unused
+    size_t bytes = clusters * sizeof(TranspositionCluster);
+    bytes = (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+
+    release();
+    transpositionTableBuffer = static_cast<TranspositionCluster *>(allocateAligned(bytes));
+    if (transpositionTableBuffer == nullptr) {
+        std::cerr << "Error: could not allocate a " << bytes / (1024 * 1024) << " MB transposition table" << std::endl;
+        std::exit(1);
+    }
+    transpositionTableSize = clusters;
+    transpositionTableMask = clusters - 1;
+
+    // Zeroing is the first touch that places the pages, once is enough
+    if (!distributeAcrossNodes())
+        clear();
+    tableEntries = 0;
+}
+
+/**
+ * Runs work(first, count) over consecutive slices of clusters, one thread per search thread.
+ */
+template<typename Work>
+static void forEachSlice(size_t clusters, Work work) {
+    std::vector<std::thread> threads;
+    int threadCount = std::max(1, Search::MAX_THREADS);
+    size_t slice = clusters / threadCount;
+    for (int threadNumber = 0; threadNumber < threadCount; threadNumber++) {
+        size_t first = slice * threadNumber;
+        size_t count = threadNumber == threadCount - 1 ? clusters - first : slice;
+        threads.emplace_back([&work, first, count] {
+            work(first, count);
+        });
+    }
+
+    for (auto &t: threads) {
+        t.join();
+    }
+}
+
 void TranspositionTable::clear() {
-    std::memset(&transpositionTableBuffer, 0, sizeof(transpositionTableBuffer));
+    if (transpositionTableBuffer == nullptr)
+        return;
+
+    forEachSlice(transpositionTableSize, [this](size_t first, size_t count) {
+        std::memset(static_cast<void *>(&transpositionTableBuffer[first]), 0, count * sizeof(TranspositionCluster));
+    });
+    tableEntries = 0;
+}
+
+/**
+ * Header of a saved table, followed by the clusters. Entries depend on the Zobrist keys through their key check and
+ * the cluster they are in, so the file is only valid for the keys it was written with.
+ */
+struct TranspositionTableFileHeader {
+    static constexpr char MAGIC[8] = {'C', 'H', 'E', 'S', 'S', 'T', 'T', '\0'};
+    static constexpr uint32_t FORMAT_VERSION = 1;
+
+    char magic[8] = {};
+    uint32_t formatVersion = 0;
+    uint32_t clusterSize = 0;
+    uint64_t clusters = 0;
+    uint64_t keyFingerprint = 0;
+    uint64_t rootKey = 0;
+    uint8_t generation = 0;
+    uint8_t reserved[23] = {};
+};
+
+static_assert(sizeof(TranspositionTableFileHeader) == 64);
+
+bool TranspositionTable::save(const std::string &path, uint64_t rootKey) const {
+    if (transpositionTableBuffer == nullptr) {
+        std::cerr << "Error: there is no transposition table to save before the first search" << std::endl;
+        return false;
+    }
+
+    TranspositionTableFileHeader header;
+    std::memcpy(header.magic, TranspositionTableFileHeader::MAGIC, sizeof(header.magic));
+    header.formatVersion = TranspositionTableFileHeader::FORMAT_VERSION;
+    header.clusterSize = sizeof(TranspositionCluster);
+    header.clusters = transpositionTableSize;
+    header.keyFingerprint = keyFingerprint();
+    header.rootKey = rootKey;
+    header.generation = generation;
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(transpositionTableBuffer),
+               static_cast<std::streamsize>(transpositionTableSize * sizeof(TranspositionCluster)));
+    if (!file) {
+        std::cerr << "Error: could not write the transposition table to " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool TranspositionTable::load(const std::string &path, uint64_t &rootKey) {
+#ifdef _WIN32
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    size_t fileSize = file ? static_cast<size_t>(file.tellg()) : 0;
+    file.seekg(0);
+    TranspositionTableFileHeader header;
+    file.read(reinterpret_cast<char *>(&header), sizeof(header));
+#else
+    int descriptor = open(path.c_str(), O_RDONLY);
+    struct stat status {};
+    size_t fileSize = descriptor >= 0 && fstat(descriptor, &status) == 0 ? static_cast<size_t>(status.st_size) : 0;
+    void *mapping = fileSize >= sizeof(TranspositionTableFileHeader)
+                        ? mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, descriptor, 0)
+                        : MAP_FAILED;
+    if (descriptor >= 0)
+        close(descriptor);
+    if (mapping == MAP_FAILED) {
+        std::cerr << "Error: could not map " << path << std::endl;
+        return false;
+    }
+    madvise(mapping, fileSize, MADV_SEQUENTIAL);
+    TranspositionTableFileHeader header;
+    std::memcpy(&header, mapping, sizeof(header));
+#endif
+
+    bool valid = std::memcmp(header.magic, TranspositionTableFileHeader::MAGIC, sizeof(header.magic)) == 0 &&
+                 header.formatVersion == TranspositionTableFileHeader::FORMAT_VERSION &&
+                 header.clusterSize == sizeof(TranspositionCluster) && std::has_single_bit(header.clusters) &&
+                 fileSize == sizeof(header) + header.clusters * sizeof(TranspositionCluster);
+    if (!valid || header.keyFingerprint != keyFingerprint()) {
+        std::cerr << "Error: " << path << (valid ? " was written with other Zobrist keys"
+                                                 : " is not a transposition table of this version") << std::endl;
+#ifndef _WIN32
+        munmap(mapping, fileSize);
+#endif
+        return false;
+    }
+
+    if (header.clusters != transpositionTableSize)
+        allocate(header.clusters);
+
+#ifdef _WIN32
+    file.read(reinterpret_cast<char *>(transpositionTableBuffer),
+              static_cast<std::streamsize>(header.clusters * sizeof(TranspositionCluster)));
+#else
+    const auto *clusters = reinterpret_cast<const TranspositionCluster *>(static_cast<char *>(mapping) + sizeof(header));
+    forEachSlice(transpositionTableSize, [this, clusters](size_t first, size_t count) {
+        std::memcpy(static_cast<void *>(&transpositionTableBuffer[first]), &clusters[first],
+                    count * sizeof(TranspositionCluster));
+    });
+    munmap(mapping, fileSize);
+#endif
+
+    std::atomic<size_t> entries = 0;
+    forEachSlice(transpositionTableSize, [this, &entries](size_t first, size_t count) {
+        size_t sliceEntries = 0;
+        for (size_t i = first; i < first + count; i++) {
+            for (const TranspositionEntry &entry: transpositionTableBuffer[i].entries)
+                sliceEntries += !entry.empty();
+        }
+        entries += sliceEntries;
+    });
+    tableEntries = entries;
+    generation = header.generation & TranspositionEntry::GENERATION_MASK;
+    rootKey = header.rootKey;
+    return true;
+}
+
+bool TranspositionTable::attachShared(const std::string &name, size_t megabytes) {
+#ifdef _WIN32
+    std::cerr << "Error: shared transposition tables need POSIX shared memory" << std::endl;
+    return false;
+#else
+    std::string segment = name.starts_with('/') ? name : '/' + name;
+    size_t bytes = SharedTableHeader::SLOT_SIZE + clustersFor(megabytes) * sizeof(TranspositionCluster);
+
+    bool created = true;
+    int descriptor = shm_open(segment.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (descriptor < 0 && errno == EEXIST) {
+        created = false;
+        descriptor = shm_open(segment.c_str(), O_RDWR, 0600);
+    }
+    if (descriptor >= 0 && created && ftruncate(descriptor, static_cast<off_t>(bytes)) != 0) {
+        close(descriptor);
+        descriptor = -1;
+        shm_unlink(segment.c_str());
+    }
+
+    // The creator sizes the segment right after creating it, until then it is empty
+    struct stat status {};
+    for (int wait = 0; !created && descriptor >= 0 && wait < 1000; wait++) {
+        if (fstat(descriptor, &status) == 0 && static_cast<size_t>(status.st_size) > SharedTableHeader::SLOT_SIZE)
+            break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (!created)
+        bytes = static_cast<size_t>(status.st_size);
+
+    void *mapping = descriptor >= 0 && bytes > SharedTableHeader::SLOT_SIZE
+                        ? mapHugePageAligned(descriptor, bytes)
+                        : MAP_FAILED;
+    if (descriptor >= 0)
+        close(descriptor);
+    if (mapping == MAP_FAILED) {
+        if (created)
+            shm_unlink(segment.c_str());
+        std::cerr << "Error: could not map the shared memory segment " << segment << std::endl;
+        return false;
+    }
+
+    auto *header = static_cast<SharedTableHeader *>(mapping);
+    auto *clusters =
+            reinterpret_cast<TranspositionCluster *>(static_cast<char *>(mapping) + SharedTableHeader::SLOT_SIZE);
+    if (created) {
+        // A new segment is zero filled, so the table starts out empty
+        header->formatVersion = SharedTableHeader::FORMAT_VERSION;
+        header->clusters = (bytes - SharedTableHeader::SLOT_SIZE) / sizeof(TranspositionCluster);
+        header->keyFingerprint = keyFingerprint();
+        if (CpuTopology::interleaveTranspositionTable)
+            CpuTopology::interleaveMemory(clusters, header->clusters * sizeof(TranspositionCluster));
+        header->magic.store(SharedTableHeader::MAGIC, std::memory_order_release);
+    } else {
+        for (int wait = 0; wait < 1000 && header->magic.load(std::memory_order_acquire) != SharedTableHeader::MAGIC;
+             wait++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+        bool valid = header->magic.load(std::memory_order_acquire) == SharedTableHeader::MAGIC &&
+                     header->formatVersion == SharedTableHeader::FORMAT_VERSION &&
+                     header->keyFingerprint == keyFingerprint() && std::has_single_bit(header->clusters) &&
+                     bytes == SharedTableHeader::SLOT_SIZE + header->clusters * sizeof(TranspositionCluster);
+        if (!valid) {
+            munmap(mapping, bytes);
+            std::cerr << "Error: " << segment << " does not hold a transposition table of this version" << std::endl;
+            return false;
+        }
+    }
+    adviseHugePages(clusters, bytes - SharedTableHeader::SLOT_SIZE);
+    header->processes++;
+
+    release();
+    sharedHeader = header;
+    sharedBytes = bytes;
+    sharedName = segment;
+    transpositionTableBuffer = clusters;
+    transpositionTableSize = header->clusters;
+    transpositionTableMask = header->clusters - 1;
     tableEntries = 0;
+    generation = header->generation & TranspositionEntry::GENERATION_MASK;
+    return true;
+#endif
+}
+
+void TranspositionTable::release() {
+#ifndef _WIN32
+    if (sharedHeader != nullptr) {
+        bool last = --sharedHeader->processes == 0;
+        munmap(sharedHeader, sharedBytes);
+        if (last)
+            shm_unlink(sharedName.c_str());
+        sharedHeader = nullptr;
+        transpositionTableBuffer = nullptr;
+        return;
+    }
+#endif
+    freeAligned(transpositionTableBuffer);
+    transpositionTableBuffer = nullptr;
+}
+
+bool TranspositionTable::distributeAcrossNodes() {
+    if (CpuTopology::nodeCount <= 1)
+        return false;
+
+    if (CpuTopology::interleaveTranspositionTable &&
+        CpuTopology::interleaveMemory(transpositionTableBuffer, transpositionTableSize * sizeof(TranspositionCluster)))
+        return false;
+
+    // Untouched pages are placed on the node of the thread that first writes them
+    std::vector<std::thread> threads;
+    size_t slice = transpositionTableSize / CpuTopology::nodeCount;
+    for (int node = 0; node < CpuTopology::nodeCount; node++) {
+        size_t first = slice * node;
+        size_t count = node == CpuTopology::nodeCount - 1 ? transpositionTableSize - first : slice;
+        threads.emplace_back([this, node, first, count] {
+            CpuTopology::pinCurrentThreadToNode(CpuTopology::nodes[node]);
+            std::memset(static_cast<void *>(&transpositionTableBuffer[first]), 0, count * sizeof(TranspositionCluster));
+        });
+    }
+
+    for (auto &t: threads) {
+        t.join();
+    }
+    return true;
 }
@@ -2,6 +2,7 @@
 
 #include <cassert>
 #include <cstdint>
+#include <string>
 #include "board.h"
 
 #define TRANSPOSITION_TABLE_LOOKUP_SUCCESS 1
@@ -11,57 +12,195 @@
 #define EXACT_BOUND 1
 #define LOWER_BOUND 0
 
-#define EXTRACT_BEST_MOVE_BITS(x) (x & 0xFFFFFFF)
-#define EXTRACT_DEPTH_SEARCHED(x) ((x >> 28) & 0xFF)
-#define EXTRACT_SCORE(x) (((x >> 36) & 0xFFFF) - 32000)
-#define EXTRACT_NODE_TYPE(x) ((x >> 52) & 0b11)
-
 /**
- *  TRANSPOSITION ENTRY:
- *  Zobrist Key: 64 bits
- *  data:
- *      Move: 28 bits
- *      depth: 8 bits
+ *  TRANSPOSITION ENTRY (10 bytes):
+ *      key check: 16 bits, the top bits of the Zobrist key ^ all other fields
+ *      move: 16 bits, from (6 bits) | to (6 bits) | promotion piece (2 bits) | promotion flag (1 bit)
  *      score: 16 bits
- *      node type: 2 bits
- *
- *      Total: 54 bits
+ *      static eval: 16 bits, uncorrected, NO_STATIC_EVAL when the side to move was in check
+ *      depth: 8 bits
+ *      node type + 1: 2 bits, 0 marks an empty entry
+ *      generation: 6 bits
  *
- *  Total: 118 bits used
+ *  The low bits of the key select the cluster, so only the top 16 bits have to be stored. Folding the other fields
+ *  into the check rejects entries torn by a concurrent write without locks.
  */
 struct TranspositionEntry {
-    uint64_t zobristKey;
-    uint64_t data;
+    static constexpr int16_t NO_STATIC_EVAL = INT16_MIN;
+    static constexpr uint8_t GENERATION_MASK = 0x3F;
+
+    uint16_t keyCheck = 0;
+    uint16_t moveBits = 0;
+    int16_t score = 0;
+    int16_t staticEval = 0;
+    uint8_t depthSearched = 0;
+    uint8_t boundAndGeneration = 0;
 
-    TranspositionEntry() : zobristKey(0), data(0) {}
-    TranspositionEntry(uint64_t m_zobristKey, Move m_bestMove, uint8_t m_depthSearched, int m_score, uint8_t m_nodeType) {
-        data = getBitsFromData(m_bestMove, m_depthSearched, m_score, m_nodeType);
-        zobristKey = m_zobristKey ^ data;
+    TranspositionEntry() = default;
+    TranspositionEntry(uint64_t m_zobristKey, uint16_t m_moveBits, uint8_t m_depthSearched, int m_score,
+                       int m_staticEval, uint8_t m_nodeType, uint8_t m_generation)
+        : moveBits(m_moveBits), score(static_cast<int16_t>(m_score)), staticEval(static_cast<int16_t>(m_staticEval)),
+          depthSearched(m_depthSearched),
+          boundAndGeneration(static_cast<uint8_t>((m_nodeType + 1) | (m_generation & GENERATION_MASK) << 2)) {
+        keyCheck = static_cast<uint16_t>(m_zobristKey >> 48) ^ fold();
     }
 
-    [[nodiscard]] uint64_t getBitsFromData(Move bestMove, uint8_t depthSearched, int score, uint8_t nodeType) const {
-        return bestMove.getMoveBits() |
-           static_cast<uint64_t>(depthSearched) << 28ULL |
-           static_cast<uint64_t>(score + 32000) << 36ULL |
-           static_cast<uint64_t>(nodeType) << 52ULL;
+    [[nodiscard]] uint16_t fold() const {
+        return moveBits ^ static_cast<uint16_t>(score) ^ static_cast<uint16_t>(staticEval) ^
+               (depthSearched | boundAndGeneration << 8);
+    }
+
+    [[nodiscard]] bool empty() const {
+        return (boundAndGeneration & 0b11) == 0;
+    }
+
+    [[nodiscard]] bool matches(uint64_t zobristKey) const {
+        return !empty() && (keyCheck ^ fold()) == static_cast<uint16_t>(zobristKey >> 48);
+    }
+
+    [[nodiscard]] int nodeType() const {
+        return (boundAndGeneration & 0b11) - 1;
+    }
+
+    [[nodiscard]] uint8_t generation() const {
+        return boundAndGeneration >> 2;
     }
 };
 
+/**
+ * One cache line of entries. A position can be stored in any entry of the cluster its key maps to, so a probe costs
+ * a single cache miss and deep entries survive next to the shallow ones that would otherwise overwrite them.
+ */
+struct alignas(64) TranspositionCluster {
+    static constexpr int CLUSTER_SIZE = 6;
+
+    TranspositionEntry entries[CLUSTER_SIZE];
+};
+
+static_assert(sizeof(TranspositionEntry) == 10);
+static_assert(sizeof(TranspositionCluster) == 64);
+
+struct SharedTableHeader;
+
 class TranspositionTable {
 public:
-    static constexpr size_t TRANSPOSITION_TABLE_SIZE = 1 << 25;
-    static constexpr size_t TRANSPOSITION_TABLE_MASK = TRANSPOSITION_TABLE_SIZE - 1;
+    /**
+     * The table holds the largest power of two of clusters that fits in the requested size, allocated on a
+     * HUGE_PAGE_SIZE boundary so that the kernel can back it with transparent huge pages.
+     */
+    static constexpr size_t DEFAULT_SIZE_MB = 512;
+    static constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+    /**
+     * When a cluster is full the entry with the lowest depth - REPLACEMENT_AGE_WEIGHT * age is replaced, age being
+     * the number of searches since it was last written or hit. Entries of earlier moves age out without a clear.
+     */
+    static constexpr int REPLACEMENT_AGE_WEIGHT = 8;
 
-    TranspositionEntry transpositionTableBuffer[TRANSPOSITION_TABLE_SIZE];
+    TranspositionCluster *transpositionTableBuffer = nullptr;
+    size_t transpositionTableSize = 0;
+    size_t transpositionTableMask = 0;
 
-    int tableEntries = 0;
+    size_t tableEntries = 0;
     int cutoffs = 0;
 
+    /**
+     * Incremented by every search, wrapping around after 64.
+     */
+    uint8_t generation = 0;
+
+    /**
+     * Set while the table lives in a shared memory segment, see attachShared.
+     */
+    SharedTableHeader *sharedHeader = nullptr;
+    size_t sharedBytes = 0;
+    std::string sharedName;
+
+    TranspositionTable() = default;
+    TranspositionTable(const TranspositionTable &) = delete;
+    TranspositionTable &operator=(const TranspositionTable &) = delete;
+    ~TranspositionTable();
+
     int tableLookup(uint64_t zobristKey, TranspositionEntry &out);
 
+    /**
+     * Packs a move into the 16 bits stored in an entry, decodeMove restores the rest of it from the position the
+     * entry belongs to. A move that does not fit the position, as after a key collision, decodes to a null move.
+     */
+    static uint16_t encodeMove(Move move);
+    static Move decodeMove(const Board &board, uint16_t moveBits);
+
     static int correctScoreForStorage(int score, int rootDepth);
     static int correctScoreForRetrieval(int score, int rootDepth);
 
-    void addEntry(uint64_t zobristKey, Move bestMove, int rootDepth, int depthSearched, int score, int nodeType);
+    void addEntry(uint64_t zobristKey, Move bestMove, int rootDepth, int depthSearched, int score, int nodeType,
+                  int staticEval);
+
+    void newSearch();
+
+    /**
+     * Replaces the table with an empty one of the given size in MB, must not be called while a search is running.
+     */
+    void resize(size_t megabytes);
+
+    /**
+     * Allocates a DEFAULT_SIZE_MB table unless one was set up already. Nothing is allocated at startup, so a process
+     * that sets a smaller size before its first search never commits the default.
+     */
+    void allocateIfNeeded();
+
+    /**
+     * Zeroes the table with one thread per search thread.
+     */
     void clear();
+
+    /**
+     * Size of the table, or the size it will be allocated with while there is none yet.
+     */
+    [[nodiscard]] size_t sizeInMegabytes() const {
+        if (transpositionTableBuffer == nullptr)
+            return DEFAULT_SIZE_MB;
+        return transpositionTableSize * sizeof(TranspositionCluster) / (1024 * 1024);
+    }
+
+    /**
+     * Writes the table behind a header holding its size, format version, a fingerprint of the Zobrist keys, the
+     * generation and rootKey, the root of the search that filled it. Entries torn by a search still running are
+     * rejected on probe like any other torn entry.
+     */
+    bool save(const std::string &path, uint64_t rootKey) const;
+
+    /**
+     * Replaces the table with one written by save, resizing it to the saved size. The file is mapped and copied in
+     * by one thread per search thread. Files of another format or Zobrist keys are rejected and leave the table
+     * as it was. Must not be called while a search is running.
+     */
+    bool load(const std::string &path, uint64_t &rootKey);
+
+    /**
+     * Moves the table into the named POSIX shared memory segment, creating it with the given size in MB unless
+     * another process already did, in which case its size is used. All processes attached to the segment probe and
+     * store into the same table, torn entries rejected by the key check like between threads, and share its
+     * generation. The contents of the private table are dropped. The last process to detach removes the segment,
+     * resize and a load of another size detach. Must not be called while a search is running.
+     */
+    bool attachShared(const std::string &name, size_t megabytes);
+
+    /**
+     * Spreads the pages of a new table over all NUMA nodes so that no single memory controller serves every probe.
+     * Interleaving is tried first, otherwise each node first-touches its own slice of the table by zeroing it.
+     * Returns whether the table was zeroed.
+     */
+    bool distributeAcrossNodes();
+
+private:
+    /**
+     * Allocates an empty table of the given number of clusters, a power of two.
+     */
+    void allocate(size_t clusters);
+
+    /**
+     * Frees the private table or detaches from the shared one.
+     */
+    void release();
 };
@@ -1,10 +1,17 @@
+#include <atomic>
 #include <chrono>
+#include <iomanip>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <thread>
 
+#include "engine/cputopology.h"
+#include "engine/montecarlosearch.h"
 #include "engine/movegen.h"
 #include "engine/openingbook.h"
 #include "engine/piecesquaretable.h"
+#include "engine/proofnumbersearch.h"
 #include "engine/san.h"
 #include "engine/search.h"
 #include "engine/zobrist.h"
@@ -15,21 +22,67 @@
 
 #ifdef CLI
 bool over = false;
+
+/**
+ * Ponder searches and infinite analyses run in the background so that commands can still be read. ponderableKey is
+ * the position after the best move of the last search, the only position a ponder can start from, and ponderKey the
+ * position after the expected reply that the background search works on.
+ */
+std::thread backgroundSearch;
+std::atomic<bool> backgroundSearchRunning = false;
+bool backgroundSearchInfinite = false;
+uint64_t ponderableKey = 0;
+uint64_t ponderKey = 0;
+
+void rememberPonderablePosition(const Board &board) {
+    Board next = board;
+    if (!Search::isNullMove(Search::bestMove) && next.move(Search::bestMove))
+        ponderableKey = next.currentZobristKey;
+}
+
+void finishBackgroundSearch(bool abort) {
+    if (!backgroundSearch.joinable())
+        return;
+
+    // A ponder that was never hit is aborted, an infinite analysis always
+    if (abort || TimeManager::pondering || backgroundSearchInfinite)
+        Search::cancelAndWait(backgroundSearchRunning);
+    backgroundSearch.join();
+}
+
+void startBackgroundSearch(const std::shared_ptr<Board> &board, const TimeControl &timeControl,
+                           const std::vector<Move> &searchMoves) {
+    backgroundSearchRunning = true;
+    backgroundSearchInfinite = timeControl.infinite;
+    backgroundSearch = std::thread([board, timeControl, searchMoves] {
+        Search::startIterativeSearch(*board, timeControl, searchMoves);
+        rememberPonderablePosition(*board);
+        std::cout << "Search complete. (" << Search::nodesCounted << " nodes, " << TimeManager::elapsed()
+                << " ms)" << std::endl;
+        backgroundSearchRunning = false;
+    });
+}
+
 void startCLIListening(Board& board) {
     int passes = 0;
     while (passes++ < 100000) {
         std::string input;
         std::getline(std::cin, input);
 
-        if (input == "exit")
+        if (input == "exit") {
+            finishBackgroundSearch(true);
             break;
+        }
         if (input == "ping") {
             std::cout << "pong\n";
         }
+        else if (input == "stop") {
+            finishBackgroundSearch(true);
+        }
         else if (input == "reset") {
+            finishBackgroundSearch(true);
             over = false;
             board.setStartingPosition();
-            Search::transpositionTable.clear();
         }
         else if (input == "print") {
             board.printBoard();
@@ -48,6 +101,18 @@ void startCLIListening(Board& board) {
                 Move moveObj = moves.buffer[i];
 
                 if (StandardAlgebraicNotation::boardToSan(board, moveObj) == move) {
+                    // The expected reply turns the ponder search into the real one, any other move aborts it
+                    Board next = board;
+                    if (backgroundSearch.joinable() && next.move(moveObj) && next.currentZobristKey == ponderKey) {
+                        // A hit that arrives before the ponder search is set up would be overwritten by it
+                        while (backgroundSearchRunning && !TimeManager::pondering)
+                            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                        TimeManager::ponderHit();
+                        std::cout << "Ponder hit" << std::endl;
+                    } else {
+                        finishBackgroundSearch(true);
+                    }
+
                     board.move(moveObj);
                     std::cout << "Moved: " << move << std::endl;
 
@@ -75,11 +140,192 @@ void startCLIListening(Board& board) {
 
             int milliseconds = std::stoi(input.substr(7));
 
+            finishBackgroundSearch(false);
             Search::startIterativeSearch(board, milliseconds);
+            rememberPonderablePosition(board);
             std::cout << "Search complete." << std::endl;
-        }else if (input.starts_with("genfen")) {
+        }
+        else if (input.starts_with("go")) {
+            if (over) {
+                std::cout << "game already ended" << std::endl;
+                continue;
+            }
+
+            // go [ponder | infinite] [wtime <ms>] [btime <ms>] [winc <ms>] [binc <ms>] [movestogo <n>] [movetime <ms>] [searchmoves <san>...]
+            // A ponder searches the expected reply to the engine's last move on the opponent's time, the clock
+            // values are still the ones of the engine. An infinite analysis runs until stop
+            std::vector<std::string> split = StandardAlgebraicNotation::split(input, ' ');
+            TimeControl timeControl;
+            timeControl.ponder = split.size() > 1 && split.at(1) == "ponder";
+            timeControl.infinite = split.size() > 1 && split.at(1) == "infinite";
+            bool engineIsWhite = timeControl.ponder ? !board.whiteToMove : board.whiteToMove;
+            std::vector<Move> searchMoves;
+            bool valid = true;
+            for (size_t i = timeControl.ponder || timeControl.infinite ? 2 : 1; i < split.size() && valid; i += 2) {
+                const std::string &name = split.at(i);
+                if (name == "searchmoves") {
+                    // Every remaining token is a move in SAN
+                    ArrayVec<Move, 218> moves = Movegen::generateAllLegalMovesOnBoard(board);
+                    for (size_t j = i + 1; j < split.size(); j++) {
+                        size_t found = searchMoves.size();
+                        for (int k = 0; k < moves.elements; k++) {
+                            if (StandardAlgebraicNotation::boardToSan(board, moves.buffer[k]) == split.at(j))
+                                searchMoves.push_back(moves.buffer[k]);
+                        }
+                        valid &= searchMoves.size() > found;
+                    }
+                    break;
+                }
+                if (i + 1 >= split.size()) {
+                    valid = false;
+                    break;
+                }
+
+                long value = std::stol(split.at(i + 1));
+                if (name == (engineIsWhite ? "wtime" : "btime"))
+                    timeControl.remaining = value;
+                else if (name == (engineIsWhite ? "winc" : "binc"))
+                    timeControl.increment = value;
+                else if (name == "movestogo")
+                    timeControl.movesToGo = static_cast<int>(value);
+                else if (name == "movetime")
+                    timeControl.moveTime = value;
+                else if (name != "wtime" && name != "btime" && name != "winc" && name != "binc")
+                    valid = false;
+            }
+            if (!valid || (timeControl.remaining < 0 && timeControl.moveTime < 0 && !timeControl.infinite)) {
+                std::cout << "Error: usage go [ponder] wtime <ms> btime <ms> [winc <ms>] [binc <ms>] [movestogo <n>], go movetime <ms> or go infinite, optionally followed by searchmoves <san>...\n";
+                continue;
+            }
+
+            finishBackgroundSearch(false);
+
+            if (timeControl.ponder) {
+                Move expectedReply = Search::getPonderMove();
+                auto ponderBoard = std::make_shared<Board>(board);
+                if (board.currentZobristKey != ponderableKey || Search::isNullMove(expectedReply) ||
+                    !ponderBoard->move(expectedReply)) {
+                    std::cout << "Error: no expected reply to ponder on" << std::endl;
+                    continue;
+                }
+
+                std::cout << "Pondering on " << StandardAlgebraicNotation::boardToSan(board, expectedReply) << std::endl;
+                ponderKey = ponderBoard->currentZobristKey;
+                startBackgroundSearch(ponderBoard, timeControl, searchMoves);
+                continue;
+            }
+
+            if (timeControl.infinite) {
+                ponderKey = 0;
+                startBackgroundSearch(std::make_shared<Board>(board), timeControl, searchMoves);
+                continue;
+            }
+
+            Search::startIterativeSearch(board, timeControl, searchMoves);
+            rememberPonderablePosition(board);
+            std::cout << "Search complete. (" << Search::nodesCounted << " nodes, " << TimeManager::elapsed() <<
+                    " ms)" << std::endl;
+        }
+        else if (input.starts_with("mate")) {
+            // mate <n> [ms]: is there a forced mate in at most n moves for the side to move?
+            std::vector<std::string> split = StandardAlgebraicNotation::split(input, ' ');
+            if (split.size() < 2 || split.size() > 3) {
+                std::cout << "Error: usage mate <moves> [milliseconds]" << std::endl;
+                continue;
+            }
+
+            finishBackgroundSearch(false);
+            int mateIn = std::stoi(split.at(1));
+            long milliseconds = split.size() == 3 ? std::stol(split.at(2)) : -1;
+            auto start = std::chrono::steady_clock::now();
+            MateSearchResult result = ProofNumberSearch::findMate(board, mateIn, milliseconds);
+            long elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start).count();
+
+            if (result.status == MateSearchResult::PROVEN)
+                std::cout << "Mate in " << result.mateIn << ": " << Search::principalVariationToSan(board, result.line);
+            else if (result.status == MateSearchResult::DISPROVEN)
+                std::cout << "No mate in " << mateIn;
+            else if (result.pathDependentDraws)
+                std::cout << "Unknown, no mate found but a repetition or fifty move draw was involved";
+            else
+                std::cout << "Unknown, out of time";
+            std::cout << " (" << result.nodes << " nodes, " << elapsed << " ms)" << std::endl;
+        }
+        else if (input.starts_with("mcts")) {
+            // mcts <ms>: PUCT tree search, continues the previous tree when the position did not change
+            if (input.length() <= 5) {
+                std::cout << "Error: usage mcts <milliseconds>" << std::endl;
+                continue;
+            }
+
+            finishBackgroundSearch(false);
+            long milliseconds = std::stol(input.substr(5));
+            auto start = std::chrono::steady_clock::now();
+            MonteCarloResult result = MonteCarloSearch::search(board, milliseconds);
+            long elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start).count();
+
+            if (result.lines.empty()) {
+                std::cout << "No legal moves" << std::endl;
+                continue;
+            }
+            for (size_t i = 0; i < std::min<size_t>(result.lines.size(), 5); i++) {
+                const MonteCarloLine &line = result.lines[i];
+                std::cout << "  " << std::fixed << std::setprecision(1) << line.winProbability * 100 << "% " <<
+                        line.visits << " " << Search::principalVariationToSan(board, line.pv) << std::endl;
+            }
+            std::cout << "Best move " << StandardAlgebraicNotation::boardToSan(board, result.bestMove) << " (" <<
+                    result.playouts << " playouts, " << result.nodes << " nodes, " << result.collisions <<
+                    " collisions, " << elapsed << " ms)" << std::endl;
+        }
+        else if (input.starts_with("savett") || input.starts_with("loadtt")) {
+            // savett <file> / loadtt <file>: keep the transposition table across restarts of the engine
+            if (input.length() <= 7) {
+                std::cout << "Error: usage savett <file> or loadtt <file>" << std::endl;
+                continue;
+            }
+
+            finishBackgroundSearch(true);
+            std::string path = input.substr(7);
+            auto start = std::chrono::steady_clock::now();
+            bool saving = input.starts_with("savett");
+            if (saving ? !Search::saveTranspositionTable(path) : !Search::loadTranspositionTable(path))
+                continue;
+            long elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start).count();
+            std::cout << (saving ? "Saved " : "Loaded ") << Search::transpositionTable.sizeInMegabytes() <<
+                    " MB transposition table (" << elapsed << " ms)" << std::endl;
+        }
+        else if (input.starts_with("sharett")) {
+            // sharett <name>: share the transposition table with every engine process attached to the same name,
+            // set hash goes back to a private table
+            if (input.length() <= 8) {
+                std::cout << "Error: usage sharett <name>" << std::endl;
+                continue;
+            }
+
+            finishBackgroundSearch(true);
+            if (!Search::transpositionTable.attachShared(input.substr(8), Search::transpositionTable.sizeInMegabytes()))
+                continue;
+            std::cout << "Sharing " << Search::transpositionTable.sizeInMegabytes() << " MB transposition table " <<
+                    Search::transpositionTable.sharedName << std::endl;
+        }
+        else if (input.starts_with("genfen")) {
             std::cout << board.generateFEN() << std::endl;
         }
+        else if (input == "params") {
+            Search::printParameters();
+        }
+        else if (input.starts_with("set ")) {
+            finishBackgroundSearch(false);
+            std::vector<std::string> split = StandardAlgebraicNotation::split(input, ' ');
+            if (split.size() != 3 || !Search::setParameter(split.at(1), std::stoi(split.at(2)))) {
+                std::cout << "Error: usage set <parameter> <value>, see params" << std::endl;
+                continue;
+            }
+            std::cout << "Set " << split.at(1) << " to " << split.at(2) << std::endl;
+        }
     }
 }
 #endif
@@ -114,6 +360,15 @@ int main() {
     std::cout << "[+] Square bias table init...\n";
     PieceSquareTable::initializePieceSquareTable();
 
+    std::cout << "[+] Late move reduction table init...\n";
+    Search::initializeLateMoveReductionTable();
+
+    std::cout << "[+] Detecting CPU topology...\n";
+    CpuTopology::init();
+    Search::MAX_THREADS = CpuTopology::recommendedThreadCount();
+    std::cout << "[+] " << CpuTopology::physicalCores << " physical cores, " << CpuTopology::placementOrder.size() <<
+            " hardware threads, " << CpuTopology::nodeCount << " NUMA node(s)\n";
+
     std::cout << "[+] Loading Opening Book..\n";
     OpeningBook::loadOpeningBook("assets/openingbook.txt");
 
@@ -8,6 +8,7 @@
 #include "GLFW/glfw3.h"
 
 #include <iostream>
+#include <memory>
 #include <thread>
 
 #include "../engine/movegen.h"
@@ -114,6 +115,9 @@ void Gui::render() {
     ImGui::BeginTabBar("tabs");
 
     if (ImGui::BeginTabItem("Analysis")) {
+        if (currentSearchType == PONDER_SEARCH)
+            Search::searchCancelled = true;
+
         ImGui::Columns(2);
         const float evaluationBarWidth = ImGui::GetColumnWidth() / 25.F;
         renderEvaluationBar(Search::currentEval, evaluationBarWidth,
@@ -140,6 +144,15 @@ void Gui::render() {
         ImGui::Text(("Engine Evaluation: " + str).c_str());
         ImGui::Text(("Depth: " + std::to_string(Search::currentDepth)).c_str());
 
+        ImGui::Text("Lines:");
+        ImGui::SliderInt("##lines", &Search::MULTI_PV, 1, 5);
+        for (const RootMove &line: Search::getPrincipalVariations()) {
+            float score = static_cast<float>((Search::lastSearchTurnIsWhite ? 1 : -1) * line.score) / 100.F;
+            char scoreText[16];
+            snprintf(scoreText, sizeof(scoreText), "%+.2f", score);
+            ImGui::TextWrapped("%s  %s", scoreText, Search::principalVariationToSan(*board, line.pv).c_str());
+        }
+
         // Sidebar
         ImGuiTableFlags flags = ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg;
 
@@ -182,6 +195,7 @@ void Gui::render() {
             Search::currentDepth = 0;
             Search::bestMove = Search::NULL_MOVE;
             board->setStartingPosition();
+            currentSearchType = NO_SEARCH;
         }
 
         if (ImGui::Button("Import FEN from clipboard")) {
@@ -225,17 +239,25 @@ void Gui::render() {
         ImGui::Columns(1);
         ImGui::EndTabItem();
 
+        // Runs until the position changes, a search on the next position picks up at the depth already reached
         if (currentSearchType == NO_SEARCH) {
             currentSearchType = ANALYSIS_SEARCH;
-
-            std::thread([]() {
-                Search::startIterativeSearch(*board, 2000000);
-            }).detach();
+            stopAnalysis();
+
+            auto analysisBoard = std::make_shared<Board>(*board);
+            analysisRunning = true;
+            analysisThread = std::thread([analysisBoard] {
+                TimeControl timeControl;
+                timeControl.infinite = true;
+                Search::startIterativeSearch(*analysisBoard, timeControl);
+                analysisRunning = false;
+            });
         }
     }
     if (ImGui::BeginTabItem("Game")) {
         if (currentSearchType == ANALYSIS_SEARCH) {
             currentSearchType = NO_SEARCH;
+            stopAnalysis();
             Search::searchCancelled = true;
         }
         ImGui::Columns(2);
@@ -243,16 +265,51 @@ void Gui::render() {
                          ImGui::GetColumnWidth() - ImGui::GetStyle().WindowPadding.x * 2, false);
         ImGui::NextColumn();
         ImGui::SliderInt("Time to think", &timeToThink, 10, 20000);
+        ImGui::Checkbox("Ponder", &ponder);
         ImGui::Columns(1);
 
+        // Once the player has replied, a matching position turns the ponder search into the real one
+        if (currentSearchType == PONDER_SEARCH && !board->whiteToMove) {
+            if (board->currentZobristKey != ponderKey)
+                Search::searchCancelled = true;
+            else if (TimeManager::pondering)
+                TimeManager::ponderHit();
+        }
+
         if (currentSearchType == NO_SEARCH && Search::searchCancelled && !board->isDrawn() && !
             Movegen::inCheckmate(*board) && !board->whiteToMove) {
             currentSearchType = GAME_SEARCH;
             std::thread([] {
                 Search::startIterativeSearch(*board, timeToThink);
-                lastMoveByBot = Search::bestMove;
-                moveAnimation = ImVec2(0, 0);
-                board->move(Search::bestMove);
+                while (true) {
+                    // Switch to pondering before the move is on the board, so the player's reply cannot start a
+                    // second search
+                    Move expectedReply = Search::getPonderMove();
+                    Board ponderBoard = *board;
+                    bool canPonder = ponder && !Search::isNullMove(expectedReply) &&
+                                     ponderBoard.move(Search::bestMove) && ponderBoard.move(expectedReply) &&
+                                     !ponderBoard.isDrawn();
+                    if (canPonder) {
+                        ponderKey = ponderBoard.currentZobristKey;
+                        currentSearchType = PONDER_SEARCH;
+                    }
+
+                    lastMoveByBot = Search::bestMove;
+                    moveAnimation = ImVec2(0, 0);
+                    board->move(Search::bestMove);
+
+                    if (!canPonder)
+                        break;
+
+                    TimeControl timeControl;
+                    timeControl.moveTime = timeToThink;
+                    timeControl.ponder = true;
+                    Search::startIterativeSearch(ponderBoard, timeControl);
+
+                    // A miss was aborted, the TT stays warm for the search on the real reply
+                    if (board->currentZobristKey != ponderKey || Search::isNullMove(Search::bestMove))
+                        break;
+                }
                 currentSearchType = NO_SEARCH;
                 Search::searchCancelled = true;
             }).detach();
@@ -266,6 +323,14 @@ void Gui::render() {
 }
 
 
+void Gui::stopAnalysis() {
+    if (!analysisThread.joinable())
+        return;
+
+    Search::cancelAndWait(analysisRunning);
+    analysisThread.join();
+}
+
 void Gui::renderChessBoard(float width, float height, bool analyze) {
     const char *id = "board";
 
@@ -327,7 +392,8 @@ void Gui::renderChessBoard(float width, float height, bool analyze) {
                     int squareY = static_cast<int>(relativeMousePos.y) / static_cast<int>(size.y / 8);
                     if (board->getPiece(draggingPieceIndex) != NONE) {
                         draggingPieceIndex = squareX + (7 - squareY) * 8;
-                        Search::searchCancelled = true;
+                        if (currentSearchType != PONDER_SEARCH)
+                            Search::searchCancelled = true;
                     }
                 }
             } else if (!ImGui::IsMouseDown(ImGuiMouseButton_Left) && draggingPieceIndex != -1) {
@@ -367,7 +433,8 @@ void Gui::renderChessBoard(float width, float height, bool analyze) {
                             availableMoves.buffer[0]
                         });
                     }
-                    currentSearchType = NO_SEARCH;
+                    if (currentSearchType != PONDER_SEARCH)
+                        currentSearchType = NO_SEARCH;
                 } else if (movesFound == 4) {
                     // Promotion
                     selectingPromotion = true;
@@ -503,7 +570,8 @@ void Gui::renderChessBoard(float width, float height, bool analyze) {
                     board->move(availableMoves.buffer[i]);
                     selectingPromotion = false;
                     availableMoves.elements = 0;
-                    currentSearchType = NO_SEARCH;
+                    if (currentSearchType != PONDER_SEARCH)
+                        currentSearchType = NO_SEARCH;
 
                     if (board->whiteToMove) {
                         blackMoveHistory.push_back({
@@ -715,6 +783,7 @@ void Gui::setupImgui() {
         glfwSwapBuffers(window);
     }
 
+    stopAnalysis();
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImPlot::DestroyContext();
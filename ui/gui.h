@@ -1,7 +1,9 @@
 #pragma once
 
 #include "../engine/board.h"
+#include <atomic>
 #include <imgui.h>
+#include <thread>
 #include <vector>
 
 #include "GLFW/glfw3.h"
@@ -9,6 +11,7 @@
 
 #define ANALYSIS_SEARCH 1
 #define GAME_SEARCH 2
+#define PONDER_SEARCH 3
 #define NO_SEARCH 0
 
 static ImVec2 operator+(const ImVec2& lhs, const ImVec2& rhs)   { return {lhs.x + rhs.x, lhs.y + rhs.y}; }
@@ -32,6 +35,20 @@ namespace Gui {
     inline Move lastMoveByBot = Move();
     inline ImVec2 moveAnimation = ImVec2(0, 0);
     inline int timeToThink = 5000;
+
+    /**
+     * With ponder enabled the engine keeps searching the reply it expects after its own move. ponderKey is the
+     * zobrist key of the position that reply leads to, so a matching key after the player's move is a ponder hit.
+     */
+    inline bool ponder = true;
+    inline uint64_t ponderKey = 0;
+
+    /**
+     * The infinite search of the Analysis tab. It only ends when cancelled, so it is joined before the next search
+     * starts instead of racing it for searchCancelled.
+     */
+    inline std::thread analysisThread;
+    inline std::atomic<bool> analysisRunning = false;
     inline std::vector<Move> arrows = std::vector<Move>();
     inline std::vector<MoveRecord> whiteMoveHistory = std::vector<MoveRecord>();
     inline std::vector<MoveRecord> blackMoveHistory = std::vector<MoveRecord>();
@@ -39,6 +56,7 @@ namespace Gui {
     void init(Board* board);
     void setupImgui();
     void render();
+    void stopAnalysis();
 
     void renderChessBoard(float width, float height, bool analyze);
     void renderEvaluationBar(int eval, float width, float height);